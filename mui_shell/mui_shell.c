@@ -56,6 +56,7 @@ typedef struct mui_xcb_t {
 	struct xkb_state *	xkb_state;
 
 	int 				redraw;
+	c2_rect_array_t		redraw_rects;	// coalesced mui->redraw
 } mui_xcb_t;
 
 
@@ -456,7 +457,8 @@ mui_xcb_poll(
 		// Handle window refresh event
 		int rc = 0;
 		c2_rect_t whole = C2_RECT(0, 0, ui->size.x, ui->size.y);
-		c2_rect_t *ra = (c2_rect_t*)pixman_region32_rectangles(&mui->redraw, &rc);
+		rc = mui_redraw_get(mui, dr, &ui->redraw_rects);
+		c2_rect_t *ra = ui->redraw_rects.e;
 		if (ui->redraw) {
 			ui->redraw = 0;
 			rc = 1;
@@ -486,7 +488,7 @@ mui_xcb_poll(
 						c2_rect_width(&r), c2_rect_height(&r));
 			}
 		}
-		pixman_region32_clear(&mui->redraw);
+		mui_redraw_ack(mui);
 	}
 	xcb_flush(ui->xcb);
 	return gameover;
@@ -502,6 +504,7 @@ mui_xcb_terminate(
     xcb_free_pixmap(ui->xcb, ui->xcb_pix);
     xcb_destroy_window(ui->xcb, ui->window);
     xcb_disconnect(ui->xcb);
+	c2_rect_array_free(&ui->redraw_rects);
 }
 
 #endif
@@ -222,6 +222,81 @@ void cg_matrix_map_point(struct cg_matrix_t * m, struct cg_point_t * p1, struct
 	p2->y = p1->x * m->b + p1->y * m->d + m->ty;
 }
 
+/*
+ * How much a unit length in user space can grow in device space, this
+ * turns the flattening tolerance (in device pixels) into a user space one.
+ */
+static inline double cg_matrix_get_scale(struct cg_matrix_t * m)
+{
+	double sx = m->a * m->a + m->b * m->b;
+	double sy = m->c * m->c + m->d * m->d;
+	return sqrt(CG_MAX(sx, sy));
+}
+
+/* Device space tolerance for flatten(), in pixels */
+#define CG_FLATTEN_TOLERANCE	0.25
+
+#define CG_ARENA_ALIGN(size)	(((size) + 15ul) & ~15ul)
+
+/* 'arena' can be NULL, that's just malloc() then */
+static void * cg_arena_alloc(struct cg_arena_t * arena, size_t size)
+{
+	if(!arena)
+		return malloc(size);
+	size = CG_ARENA_ALIGN(size);
+	arena->stats.allocs++;
+	if(arena->used + size > arena->stats.size)
+	{
+		arena->stats.mallocs++;
+		arena->stats.overflow += size;
+		return malloc(size);
+	}
+	void * p = arena->data + arena->used;
+	arena->used += size;
+	arena->live++;
+	if(arena->used > arena->stats.peak)
+		arena->stats.peak = arena->used;
+	return p;
+}
+
+/* Anything not from the arena is free()ed, so the callers don't care */
+static void cg_arena_free(struct cg_arena_t * arena, void * p)
+{
+	if(!p)
+		return;
+	if(arena && ((char *)p >= arena->data) && ((char *)p < arena->data + arena->stats.size))
+	{
+		/* save/restore are nested, so that's usually back to empty */
+		if(--arena->live == 0)
+			arena->used = 0;
+		return;
+	}
+	free(p);
+}
+
+/*
+ * Call at the end of a frame. If something still uses the arena (an
+ * unbalanced cg_save()) it's left alone, the stats still roll over.
+ */
+void cg_arena_reset(struct cg_ctx_t * ctx)
+{
+	struct cg_arena_t * arena = &ctx->arena;
+	size_t size = arena->stats.size;
+	arena->last = arena->stats;
+	if(arena->live == 0)
+	{
+		arena->used = 0;
+		if(arena->stats.mallocs)
+		{
+			size = CG_MAX(size * 2, CG_ARENA_ALIGN(arena->stats.peak + arena->stats.overflow));
+			free(arena->data);
+			arena->data = malloc(size);
+		}
+	}
+	memset(&arena->stats, 0, sizeof(arena->stats));
+	arena->stats.size = size;
+}
+
 struct cg_surface_t * cg_surface_create(int width, int height)
 {
 	struct cg_surface_t * surface = malloc(sizeof(struct cg_surface_t));
@@ -529,7 +604,112 @@ static inline void split(struct cg_bezier_t * b, struct cg_bezier_t * first, str
 	first->y4 = second->y1 = (first->y3 + second->y2) * 0.5;
 }
 
-static inline void flatten(struct cg_path_t * path, struct cg_point_t * p0, struct cg_point_t * p1, struct cg_point_t * p2, struct cg_point_t * p3)
+/*
+ * Dashing is a filter between the flattening and whatever wants the dashes
+ * (usually the stroker), so no dashed path is built. The dasher gets the
+ * flattened lines, and calls move_to()/line_to() for the 'on' parts. Each
+ * subpath starts with the dash state from the dash offset.
+ */
+struct cg_dasher_t {
+	struct cg_dash_t * dash;
+	int toggle, offset;
+	double phase;
+	int itoggle, ioffset;
+	double iphase;
+	double x, y;
+	void (*move_to)(struct cg_dasher_t * d, double x, double y);
+	void (*line_to)(struct cg_dasher_t * d, double x, double y);
+	void * user;
+};
+
+static int cg_dasher_init(struct cg_dasher_t * d, struct cg_dash_t * dash)
+{
+	if((dash->data == NULL) || (dash->size <= 0))
+		return 0;
+	d->dash = dash;
+	d->toggle = 1;
+	d->offset = 0;
+	d->phase = dash->offset;
+	while(d->phase >= dash->data[d->offset])
+	{
+		d->toggle = !d->toggle;
+		d->phase -= dash->data[d->offset];
+		d->offset += 1;
+		if(d->offset == dash->size)
+			d->offset = 0;
+	}
+	return 1;
+}
+
+static inline void cg_dasher_start(struct cg_dasher_t * d, double x, double y)
+{
+	d->itoggle = d->toggle;
+	d->ioffset = d->offset;
+	d->iphase = d->phase;
+	d->x = x;
+	d->y = y;
+	if(d->itoggle)
+		d->move_to(d, x, y);
+}
+
+static void cg_dasher_line_to(struct cg_dasher_t * d, double x, double y)
+{
+	struct cg_dash_t * dash = d->dash;
+	double dx = x - d->x;
+	double dy = y - d->y;
+	double dist0 = sqrt(dx * dx + dy * dy);
+	double dist1 = 0;
+	while(dist0 - dist1 > dash->data[d->ioffset] - d->iphase)
+	{
+		dist1 += dash->data[d->ioffset] - d->iphase;
+		double a = dist1 / dist0;
+		double px = d->x + a * dx;
+		double py = d->y + a * dy;
+		if(d->itoggle)
+			d->line_to(d, px, py);
+		else
+			d->move_to(d, px, py);
+		d->itoggle = !d->itoggle;
+		d->iphase = 0;
+		d->ioffset += 1;
+		if(d->ioffset == dash->size)
+			d->ioffset = 0;
+	}
+	d->iphase += dist0 - dist1;
+	d->x = x;
+	d->y = y;
+	if(d->itoggle)
+		d->line_to(d, x, y);
+}
+
+/*
+ * Distance from (x, y) to the chord that starts at (x1, y1) and goes by
+ * (dx, dy), 'l2' being its length squared. Past either end, that's the
+ * distance to that end, so loops and cusps along the chord count too.
+ */
+static inline double cg_chord_distance(double x1, double y1, double dx, double dy, double l2, double x, double y)
+{
+	double px = x - x1;
+	double py = y - y1;
+	if(l2 > 0.0)
+	{
+		double t = px * dx + py * dy;
+		if(t >= l2)
+		{
+			px -= dx;
+			py -= dy;
+		}
+		else if(t > 0.0)
+			return fabs(px * dy - py * dx) / sqrt(l2);
+	}
+	return sqrt(px * px + py * py);
+}
+
+/*
+ * A curve is flat enough when both control points are within 'tolerance'
+ * of its chord. 'tolerance' is in user space, see CG_FLATTEN_TOLERANCE.
+ */
+static inline void flatten(struct cg_dasher_t * d, struct cg_point_t * p0, struct cg_point_t * p1, struct cg_point_t * p2, struct cg_point_t * p3, double tolerance)
 {
 	struct cg_bezier_t beziers[32];
 	struct cg_bezier_t * b = beziers;
@@ -544,22 +724,14 @@ static inline void flatten(struct cg_path_t * path, struct cg_point_t * p0, stru
 	beziers[0].y4 = p3->y;
 	while(b >= beziers)
 	{
-		double y4y1 = b->y4 - b->y1;
-		double x4x1 = b->x4 - b->x1;
-		double l = fabs(x4x1) + fabs(y4y1);
-		double d;
-		if(l > 1.0)
-		{
-			d = fabs((x4x1) * (b->y1 - b->y2) - (y4y1) * (b->x1 - b->x2)) + fabs((x4x1) * (b->y1 - b->y3) - (y4y1) * (b->x1 - b->x3));
-		}
-		else
-		{
-			d = fabs(b->x1 - b->x2) + fabs(b->y1 - b->y2) + fabs(b->x1 - b->x3) + fabs(b->y1 - b->y3);
-			l = 1.0;
-		}
-		if((d < l * 0.25) || (b == beziers + 31))
+		double dx = b->x4 - b->x1;
+		double dy = b->y4 - b->y1;
+		double l2 = dx * dx + dy * dy;
+		double d2 = cg_chord_distance(b->x1, b->y1, dx, dy, l2, b->x2, b->y2);
+		double d3 = cg_chord_distance(b->x1, b->y1, dx, dy, l2, b->x3, b->y3);
+		if(((d2 < tolerance) && (d3 < tolerance)) || (b == beziers + 31))
 		{
-			cg_path_line_to(path, b->x4, b->y4);
+			cg_dasher_line_to(d, b->x4, b->y4);
 			--b;
 		}
 		else
@@ -570,65 +742,45 @@ static inline void flatten(struct cg_path_t * path, struct cg_point_t * p0, stru
 	}
 }
 
-static inline struct cg_path_t * cg_path_clone(const struct cg_path_t * path)
-{
-	struct cg_path_t * result = cg_path_create();
-	cg_array_ensure(result->elements, path->elements.size);
-	cg_array_ensure(result->points, path->points.size);
-
-	memcpy(result->elements.data, path->elements.data, (size_t)path->elements.size * sizeof(enum cg_path_element_t));
-	memcpy(result->points.data, path->points.data, (size_t)path->points.size * sizeof(struct cg_point_t));
-
-	result->elements.size = path->elements.size;
-	result->points.size = path->points.size;
-	result->contours = path->contours;
-	result->start = path->start;
-	return result;
-}
-
-static inline struct cg_path_t * cg_path_clone_flat(struct cg_path_t * path)
+/* Flattens 'path' into the dasher, curves with flatten(), closes as a line */
+static void cg_dasher_path(struct cg_dasher_t * d, struct cg_path_t * path, double tolerance)
 {
 	struct cg_point_t * points = path->points.data;
-	struct cg_path_t * result = cg_path_create();
 	struct cg_point_t p0;
 
-	cg_array_ensure(result->elements, path->elements.size);
-	cg_array_ensure(result->points, path->points.size);
 	for(int i = 0; i < path->elements.size; i++)
 	{
 		switch(path->elements.data[i])
 		{
 		case CG_PATH_ELEMENT_MOVE_TO:
-			cg_path_move_to(result, points[0].x, points[0].y);
+			cg_dasher_start(d, points[0].x, points[0].y);
 			points += 1;
 			break;
 		case CG_PATH_ELEMENT_LINE_TO:
-			cg_path_line_to(result, points[0].x, points[0].y);
+		case CG_PATH_ELEMENT_CLOSE:
+			cg_dasher_line_to(d, points[0].x, points[0].y);
 			points += 1;
 			break;
 		case CG_PATH_ELEMENT_CURVE_TO:
-			cg_path_get_current_point(result, &p0.x, &p0.y);
-			flatten(result, &p0, points, points + 1, points + 2);
+			p0.x = d->x;
+			p0.y = d->y;
+			flatten(d, &p0, points, points + 1, points + 2, tolerance);
 			points += 3;
 			break;
-		case CG_PATH_ELEMENT_CLOSE:
-			cg_path_line_to(result, points[0].x, points[0].y);
-			points += 1;
-			break;
 		default:
 			break;
 		}
 	}
-	return result;
 }
 
-static struct cg_dash_t * cg_dash_create(double * dashes, int ndash, double offset)
+/* The dash values are allocated along with the struct */
+static struct cg_dash_t * cg_dash_create(struct cg_arena_t * arena, double * dashes, int ndash, double offset)
 {
 	if(dashes && (ndash > 0))
 	{
-		struct cg_dash_t * dash = malloc(sizeof(struct cg_dash_t));
+		struct cg_dash_t * dash = cg_arena_alloc(arena, sizeof(struct cg_dash_t) + (size_t)ndash * sizeof(double));
 		dash->offset = offset;
-		dash->data = malloc((size_t)ndash * sizeof(double));
+		dash->data = (double *)(dash + 1);
 		dash->size = ndash;
 		memcpy(dash->data, dashes, (size_t)ndash * sizeof(double));
 		return dash;
@@ -636,91 +788,16 @@ static struct cg_dash_t * cg_dash_create(double * dashes, int ndash, double offs
 	return NULL;
 }
 
-static struct cg_dash_t * cg_dash_clone(struct cg_dash_t * dash)
+static struct cg_dash_t * cg_dash_clone(struct cg_arena_t * arena, struct cg_dash_t * dash)
 {
 	if(dash)
-		return cg_dash_create(dash->data, dash->size, dash->offset);
+		return cg_dash_create(arena, dash->data, dash->size, dash->offset);
 	return NULL;
 }
 
-static void cg_dash_destroy(struct cg_dash_t * dash)
-{
-	if(dash)
-	{
-		free(dash->data);
-		free(dash);
-	}
-}
-
-static inline struct cg_path_t * cg_dash_path(struct cg_dash_t * dash, struct cg_path_t * path)
+static void cg_dash_destroy(struct cg_arena_t * arena, struct cg_dash_t * dash)
 {
-	if((dash->data == NULL) || (dash->size <= 0))
-		return cg_path_clone(path);
-
-	int toggle = 1;
-	int offset = 0;
-	double phase = dash->offset;
-	while(phase >= dash->data[offset])
-	{
-		toggle = !toggle;
-		phase -= dash->data[offset];
-		offset += 1;
-		if(offset == dash->size)
-			offset = 0;
-	}
-
-	struct cg_path_t * flat = cg_path_clone_flat(path);
-	struct cg_path_t * result = cg_path_create();
-	cg_array_ensure(result->elements, flat->elements.size);
-	cg_array_ensure(result->points, flat->points.size);
-
-	enum cg_path_element_t * elements = flat->elements.data;
-	enum cg_path_element_t * end = elements + flat->elements.size;
-	struct cg_point_t * points = flat->points.data;
-	while(elements < end)
-	{
-		int itoggle = toggle;
-		int ioffset = offset;
-		double iphase = phase;
-		double x0 = points->x;
-		double y0 = points->y;
-		if(itoggle)
-			cg_path_move_to(result, x0, y0);
-		++elements;
-		++points;
-		while((elements < end) && (*elements == CG_PATH_ELEMENT_LINE_TO))
-		{
-			double dx = points->x - x0;
-			double dy = points->y - y0;
-			double dist0 = sqrt(dx * dx + dy * dy);
-			double dist1 = 0;
-			while(dist0 - dist1 > dash->data[ioffset] - iphase)
-			{
-				dist1 += dash->data[ioffset] - iphase;
-				double a = dist1 / dist0;
-				double x = x0 + a * dx;
-				double y = y0 + a * dy;
-				if(itoggle)
-					cg_path_line_to(result, x, y);
-				else
-					cg_path_move_to(result, x, y);
-				itoggle = !itoggle;
-				iphase = 0;
-				ioffset += 1;
-				if(ioffset == dash->size)
-					ioffset = 0;
-			}
-			iphase += dist0 - dist1;
-			x0 = points->x;
-			y0 = points->y;
-			if(itoggle)
-				cg_path_line_to(result, x0, y0);
-			++elements;
-			++points;
-		}
-	}
-	cg_path_destroy(flat);
-	return result;
+	cg_arena_free(arena, dash);
 }
 
 #define ALIGN_SIZE(size)	(((size) + 7ul) & ~7ul)
@@ -815,30 +892,49 @@ static void ft_outline_end(XCG_FT_Outline * ft)
 	}
 }
 
+/*
+ * libmui mostly draws with an identity or translation matrix, in which case
+ * the points are just offset, which gives exactly the same result as
+ * cg_matrix_map_point(), without the multiplies.
+ */
 static void ft_outline_convert(XCG_FT_Outline * outline, struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_matrix_t * matrix)
 {
 	ft_outline_init(outline, ctx, path->points.size, path->contours);
 	enum cg_path_element_t * elements = path->elements.data;
 	struct cg_point_t * points = path->points.data;
 	struct cg_point_t p[3];
+	int translate = (matrix->a == 1.0) && (matrix->b == 0.0) &&
+				(matrix->c == 0.0) && (matrix->d == 1.0);
+	double tx = matrix->tx;
+	double ty = matrix->ty;
+#define CG_MAP_POINT(_i) \
+	do { \
+		if(translate) \
+		{ \
+			p[_i].x = points[_i].x + tx; \
+			p[_i].y = points[_i].y + ty; \
+		} \
+		else \
+			cg_matrix_map_point(matrix, &points[_i], &p[_i]); \
+	} while(0)
 	for(int i = 0; i < path->elements.size; i++)
 	{
 		switch(elements[i])
 		{
 		case CG_PATH_ELEMENT_MOVE_TO:
-			cg_matrix_map_point(matrix, &points[0], &p[0]);
+			CG_MAP_POINT(0);
 			ft_outline_move_to(outline, p[0].x, p[0].y);
 			points += 1;
 			break;
 		case CG_PATH_ELEMENT_LINE_TO:
-			cg_matrix_map_point(matrix, &points[0], &p[0]);
+			CG_MAP_POINT(0);
 			ft_outline_line_to(outline, p[0].x, p[0].y);
 			points += 1;
 			break;
 		case CG_PATH_ELEMENT_CURVE_TO:
-			cg_matrix_map_point(matrix, &points[0], &p[0]);
-			cg_matrix_map_point(matrix, &points[1], &p[1]);
-			cg_matrix_map_point(matrix, &points[2], &p[2]);
+			CG_MAP_POINT(0);
+			CG_MAP_POINT(1);
+			CG_MAP_POINT(2);
 			ft_outline_curve_to(outline, p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y);
 			points += 3;
 			break;
@@ -848,14 +944,79 @@ static void ft_outline_convert(XCG_FT_Outline * outline, struct cg_ctx_t * ctx,
 			break;
 		}
 	}
+#undef CG_MAP_POINT
 	ft_outline_end(outline);
 }
 
-static void ft_outline_convert_dash(XCG_FT_Outline * outline, struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_matrix_t * matrix, struct cg_dash_t * dash)
+/*
+ * Dashes go straight to the stroker, as XCG_FT_Stroker_ParseOutline() would
+ * have passed them from a converted dashed path: the points are mapped the
+ * same way as ft_outline_convert(), and dashes that are just a point are
+ * skipped.
+ */
+struct cg_dash_stroker_t {
+	XCG_FT_Stroker stroker;
+	struct cg_matrix_t * matrix;
+	int translate;
+	XCG_FT_Vector start;
+	int open;
+};
+
+static void cg_dash_stroker_map(struct cg_dash_stroker_t * s, double x, double y, XCG_FT_Vector * v)
+{
+	struct cg_point_t p = { x, y };
+	if(s->translate)
+	{
+		p.x += s->matrix->tx;
+		p.y += s->matrix->ty;
+	}
+	else
+		cg_matrix_map_point(s->matrix, &p, &p);
+	v->x = FT_COORD(p.x);
+	v->y = FT_COORD(p.y);
+}
+
+static void cg_dash_stroker_move_to(struct cg_dasher_t * d, double x, double y)
+{
+	struct cg_dash_stroker_t * s = d->user;
+	if(s->open)
+		XCG_FT_Stroker_EndContour(s->stroker);
+	s->open = 0;
+	cg_dash_stroker_map(s, x, y, &s->start);
+}
+
+static void cg_dash_stroker_line_to(struct cg_dasher_t * d, double x, double y)
 {
-	struct cg_path_t * dashed = cg_dash_path(dash, path);
-	ft_outline_convert(outline, ctx, dashed, matrix);
-	cg_path_destroy(dashed);
+	struct cg_dash_stroker_t * s = d->user;
+	XCG_FT_Vector v;
+	if(!s->open)
+		XCG_FT_Stroker_BeginSubPath(s->stroker, &s->start, 1);
+	s->open = 1;
+	cg_dash_stroker_map(s, x, y, &v);
+	XCG_FT_Stroker_LineTo(s->stroker, &v);
+}
+
+static int cg_dash_stroke(XCG_FT_Stroker stroker, struct cg_path_t * path, struct cg_matrix_t * matrix, struct cg_dash_t * dash)
+{
+	struct cg_dasher_t d;
+	if(!cg_dasher_init(&d, dash))
+		return 0;
+	struct cg_dash_stroker_t s = {
+		.stroker = stroker,
+		.matrix = matrix,
+		.translate = (matrix->a == 1.0) && (matrix->b == 0.0) &&
+				(matrix->c == 0.0) && (matrix->d == 1.0),
+	};
+	double scale = cg_matrix_get_scale(matrix);
+	double tolerance = scale > 0.0 ? CG_FLATTEN_TOLERANCE / scale : CG_FLATTEN_TOLERANCE;
+	d.move_to = cg_dash_stroker_move_to;
+	d.line_to = cg_dash_stroker_line_to;
+	d.user = &s;
+	XCG_FT_Stroker_Rewind(stroker);
+	cg_dasher_path(&d, path, tolerance);
+	if(s.open)
+		XCG_FT_Stroker_EndContour(stroker);
+	return 1;
 }
 
 static void generation_callback(int count, const XCG_FT_Span * spans, void * user)
@@ -887,12 +1048,15 @@ static void cg_rle_destroy(struct cg_rle_t * rle)
 	}
 }
 
-static void cg_rle_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_rect_t * clip, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding)
+/* Rasterize 'path' (or its stroke), 'spans' gets the spans as they are generated */
+static void cg_rasterize(struct cg_ctx_t * ctx, XCG_FT_SpanFunc spans, void * user, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_rect_t * clip, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding)
 {
 	XCG_FT_Raster_Params params;
 	params.flags = XCG_FT_RASTER_FLAG_DIRECT | XCG_FT_RASTER_FLAG_AA;
-	params.gray_spans = generation_callback;
-	params.user = rle;
+	params.gray_spans = spans;
+	params.user = user;
+	params.threads = ctx->raster_threads;
+	params.pool = &ctx->raster_pool;
 	if(clip)
 	{
 		params.flags |= XCG_FT_RASTER_FLAG_CLIP;
@@ -904,24 +1068,16 @@ static void cg_rle_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struc
 	if(stroke)
 	{
 		XCG_FT_Outline outline;
-		if(stroke->dash == NULL)
-			ft_outline_convert(&outline, ctx, path, m);
-		else
-			ft_outline_convert_dash(&outline, ctx, path, m, stroke->dash);
 		XCG_FT_Stroker_LineCap ftCap;
 		XCG_FT_Stroker_LineJoin ftJoin;
 		XCG_FT_Fixed ftWidth;
 		XCG_FT_Fixed ftMiterLimit;
 
-		struct cg_point_t p1 = { 0, 0 };
-		struct cg_point_t p2 = { 1.41421356237309504880, 1.41421356237309504880 };
-		struct cg_point_t p3;
-
-		cg_matrix_map_point(m, &p1, &p1);
-		cg_matrix_map_point(m, &p2, &p2);
-
-		p3.x = p2.x - p1.x;
-		p3.y = p2.y - p1.y;
+		/* just the linear part, so the width doesn't depend on the translation */
+		struct cg_point_t p3 = {
+			(m->a + m->c) * 1.41421356237309504880,
+			(m->b + m->d) * 1.41421356237309504880,
+		};
 
 		double scale = sqrt(p3.x * p3.x + p3.y * p3.y) / 2.0;
 
@@ -952,10 +1108,16 @@ static void cg_rle_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struc
 			ftJoin = XCG_FT_STROKER_LINEJOIN_MITER_FIXED;
 			break;
 		}
-		XCG_FT_Stroker stroker;
-		XCG_FT_Stroker_New(&stroker);
+		/* the stroker keeps its border buffers from one stroke to the next */
+		if(!ctx->stroker)
+			XCG_FT_Stroker_New(&ctx->stroker);
+		XCG_FT_Stroker stroker = ctx->stroker;
 		XCG_FT_Stroker_Set(stroker, ftWidth, ftCap, ftJoin, ftMiterLimit);
-		XCG_FT_Stroker_ParseOutline(stroker, &outline);
+		if(!stroke->dash || !cg_dash_stroke(stroker, path, m, stroke->dash))
+		{
+			ft_outline_convert(&outline, ctx, path, m);
+			XCG_FT_Stroker_ParseOutline(stroker, &outline);
+		}
 
 		XCG_FT_UInt points;
 		XCG_FT_UInt contours;
@@ -963,7 +1125,6 @@ static void cg_rle_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struc
 
 		ft_outline_init(&outline, ctx, points, contours);
 		XCG_FT_Stroker_Export(stroker, &outline);
-		XCG_FT_Stroker_Done(stroker);
 
 		outline.flags = XCG_FT_OUTLINE_NONE;
 		params.source = &outline;
@@ -986,7 +1147,11 @@ static void cg_rle_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struc
 		params.source = &outline;
 		XCG_FT_Raster_Render(&params);
 	}
+}
 
+static void cg_rle_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_rect_t * clip, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding)
+{
+	cg_rasterize(ctx, generation_callback, rle, path, m, clip, stroke, winding);
 	if(rle->spans.size == 0)
 	{
 		rle->x = 0;
@@ -1015,10 +1180,19 @@ static void cg_rle_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struc
 	rle->h = y2 - y1 + 1;
 }
 
-static struct cg_rle_t * cg_rle_intersection(struct cg_rle_t * a, struct cg_rle_t * b)
+static inline void cg_rle_clear(struct cg_rle_t * rle)
+{
+	rle->spans.size = 0;
+	rle->x = 0;
+	rle->y = 0;
+	rle->w = 0;
+	rle->h = 0;
+}
+
+/* The intersection of 'a' and 'b' goes in 'result', which is reused */
+static void cg_rle_intersection(struct cg_rle_t * a, struct cg_rle_t * b, struct cg_rle_t * result)
 {
-	struct cg_rle_t * result = malloc(sizeof(struct cg_rle_t));
-	cg_array_init(result->spans);
+	result->spans.size = 0;
 	cg_array_ensure(result->spans, CG_MAX(a->spans.size, b->spans.size));
 
 	struct cg_span_t * a_spans = a->spans.data;
@@ -1096,7 +1270,7 @@ static struct cg_rle_t * cg_rle_intersection(struct cg_rle_t * a, struct cg_rle_
 		result->y = 0;
 		result->w = 0;
 		result->h = 0;
-		return result;
+		return;
 	}
 	struct cg_span_t * spans = result->spans.data;
 	int x1 = INT_MAX;
@@ -1123,23 +1297,120 @@ static struct cg_rle_t * cg_rle_intersection(struct cg_rle_t * a, struct cg_rle_
 				result->spans.size, result->spans.capacity);
 		*/
 	}
-	return result;
 }
 
-static void cg_rle_clip_path(struct cg_rle_t * rle, struct cg_rle_t * clip)
+/*
+ * The intersection is made in 'spare', then the span arrays are swapped,
+ * so nothing is allocated once they have grown big enough.
+ */
+static void cg_rle_clip_path(struct cg_rle_t * rle, struct cg_rle_t * clip, struct cg_rle_t * spare)
 {
 	if(rle && clip)
 	{
-		struct cg_rle_t * result = cg_rle_intersection(rle, clip);
-		cg_array_ensure(rle->spans, result->spans.size);
-		memcpy(rle->spans.data, result->spans.data, (size_t)result->spans.size * sizeof(struct cg_span_t));
-		rle->spans.size = result->spans.size;
-		rle->x = result->x;
-		rle->y = result->y;
-		rle->w = result->w;
-		rle->h = result->h;
-		cg_rle_destroy(result);
+		cg_rle_intersection(rle, clip, spare);
+		struct cg_span_t * data = rle->spans.data;
+		int capacity = rle->spans.capacity;
+		rle->spans = spare->spans;
+		rle->x = spare->x;
+		rle->y = spare->y;
+		rle->w = spare->w;
+		rle->h = spare->h;
+		spare->spans.data = data;
+		spare->spans.capacity = capacity;
+		spare->spans.size = 0;
+	}
+}
+
+/*
+ * Clips 'rle' to a y-x banded list of boxes. The result is built in 'out',
+ * then the span arrays are swapped, so once both have grown to size this
+ * doesn't allocate anything. The band for a row, and the first box of that
+ * band a span touches, are found with a binary search.
+ */
+static void cg_rle_clip_boxes(struct cg_rle_t * rle, struct cg_rle_t * out, struct cg_box_t * boxes, int nbox)
+{
+	out->spans.size = 0;
+	int x1 = INT_MAX;
+	int x2 = INT_MIN;
+	int y = INT_MIN;
+	int b0 = 0, b1 = 0;
+	struct cg_span_t * span = rle->spans.data;
+	struct cg_span_t * end = span + rle->spans.size;
+	for(; span < end; span++)
+	{
+		if(span->y != y)
+		{
+			y = span->y;
+			int lo = 0, hi = nbox;
+			while(lo < hi)
+			{
+				int mid = (lo + hi) >> 1;
+				if(boxes[mid].y2 <= y)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			b0 = b1 = lo;
+			if((lo < nbox) && (boxes[lo].y1 <= y))
+			{
+				hi = nbox;
+				while(lo < hi)
+				{
+					int mid = (lo + hi) >> 1;
+					if(boxes[mid].y1 <= boxes[b0].y1)
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
+				b1 = lo;
+			}
+		}
+		if(b0 == b1)
+			continue;
+		int sx1 = span->x;
+		int sx2 = sx1 + span->len;
+		int lo = b0, hi = b1;
+		while(lo < hi)
+		{
+			int mid = (lo + hi) >> 1;
+			if(boxes[mid].x2 <= sx1)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for(; (lo < b1) && (boxes[lo].x1 < sx2); lo++)
+		{
+			int x = CG_MAX(sx1, boxes[lo].x1);
+			int len = CG_MIN(sx2, boxes[lo].x2) - x;
+			if(len <= 0)
+				continue;
+			cg_array_ensure(out->spans, 1);
+			struct cg_span_t * o = out->spans.data + out->spans.size++;
+			o->x = x;
+			o->len = len;
+			o->y = y;
+			o->coverage = span->coverage;
+			if(x < x1)
+				x1 = x;
+			if(x + len > x2)
+				x2 = x + len;
+		}
+	}
+	struct cg_span_t * data = rle->spans.data;
+	int capacity = rle->spans.capacity;
+	rle->spans = out->spans;
+	out->spans.data = data;
+	out->spans.capacity = capacity;
+	out->spans.size = 0;
+	if(rle->spans.size == 0)
+	{
+		cg_rle_clear(rle);
+		return;
 	}
+	rle->x = x1;
+	rle->y = rle->spans.data[0].y;
+	rle->w = x2 - x1;
+	rle->h = rle->spans.data[rle->spans.size - 1].y - rle->y + 1;
 }
 
 static struct cg_rle_t * cg_rle_clone(struct cg_rle_t * rle)
@@ -1160,15 +1431,6 @@ static struct cg_rle_t * cg_rle_clone(struct cg_rle_t * rle)
 	return NULL;
 }
 
-static inline void cg_rle_clear(struct cg_rle_t * rle)
-{
-	rle->spans.size = 0;
-	rle->x = 0;
-	rle->y = 0;
-	rle->w = 0;
-	rle->h = 0;
-}
-
 static void cg_gradient_init_linear(struct cg_gradient_t * gradient, double x1, double y1, double x2, double y2)
 {
 	gradient->type = CG_GRADIENT_TYPE_LINEAR;
@@ -1366,7 +1628,7 @@ static void cg_paint_copy(struct cg_paint_t * paint, struct cg_paint_t * source)
 struct cg_gradient_data_t {
 	enum cg_spread_method_t spread;
 	struct cg_matrix_t matrix;
-	uint32_t colortable[1024];
+	uint32_t * colortable;
 	union {
 		struct {
 			double x1, y1;
@@ -1778,8 +2040,40 @@ static void __cg_comp_destination_out(uint32_t * dst, int len, uint32_t * src, u
 }
 cg_weak_alias(cg_comp_destination_out);
 
+/*
+ * Vector versions of the above, see cg_comp.h. SSE2 (x86_64) and NEON
+ * (aarch64) are always there when the compiler says so, AVX2 is compiled
+ * in anyway on x86_64, and picked at runtime if the CPU has it.
+ */
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#define CG_COMP_V4 1
+typedef uint32_t cg_v4_t __attribute__((vector_size(16)));
+#define CG_V			cg_v4_t
+#define CG_VN			4
+#define CG_V_ATTR
+#define CG_V_NAME(_n)	_n##_v4
+#include "cg_comp.h"
+#undef CG_V
+#undef CG_VN
+#undef CG_V_ATTR
+#undef CG_V_NAME
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CG_COMP_V8 1
+typedef uint32_t cg_v8_t __attribute__((vector_size(32)));
+#define CG_V			cg_v8_t
+#define CG_VN			8
+#define CG_V_ATTR		__attribute__((target("avx2")))
+#define CG_V_NAME(_n)	_n##_v8
+#include "cg_comp.h"
+#undef CG_V
+#undef CG_VN
+#undef CG_V_ATTR
+#undef CG_V_NAME
+#endif
+
 typedef void (*cg_comp_solid_function_t)(uint32_t * dst, int len, uint32_t color, uint32_t alpha);
-static const cg_comp_solid_function_t cg_comp_solid_map[] = {
+static cg_comp_solid_function_t cg_comp_solid_map[] = {
 	cg_comp_solid_source,
 	cg_comp_solid_source_over,
 	cg_comp_solid_destination_in,
@@ -1787,13 +2081,47 @@ static const cg_comp_solid_function_t cg_comp_solid_map[] = {
 };
 
 typedef void (*cg_comp_function_t)(uint32_t * dst, int len, uint32_t * src, uint32_t alpha);
-static const cg_comp_function_t cg_comp_map[] = {
+static cg_comp_function_t cg_comp_map[] = {
 	cg_comp_source,
 	cg_comp_source_over,
 	cg_comp_destination_in,
 	cg_comp_destination_out,
 };
 
+/*
+ * Replace the scalar functions in the maps by the best vector version
+ * the CPU can do. Functions that were overridden (the weak aliases) are
+ * left alone.
+ */
+#define CG_COMP_PICK(_map, _i, _name, _v) \
+	if(_map[_i] == __##_name) _map[_i] = _name##_##_v
+#define CG_COMP_PICK_ALL(_v) \
+	do { \
+		CG_COMP_PICK(cg_comp_solid_map, 0, cg_comp_solid_source, _v); \
+		CG_COMP_PICK(cg_comp_solid_map, 1, cg_comp_solid_source_over, _v); \
+		CG_COMP_PICK(cg_comp_solid_map, 2, cg_comp_solid_destination_in, _v); \
+		CG_COMP_PICK(cg_comp_solid_map, 3, cg_comp_solid_destination_out, _v); \
+		CG_COMP_PICK(cg_comp_map, 0, cg_comp_source, _v); \
+		CG_COMP_PICK(cg_comp_map, 1, cg_comp_source_over, _v); \
+		CG_COMP_PICK(cg_comp_map, 2, cg_comp_destination_in, _v); \
+		CG_COMP_PICK(cg_comp_map, 3, cg_comp_destination_out, _v); \
+	} while(0)
+
+static void __attribute__((constructor)) cg_comp_init(void)
+{
+#if CG_COMP_V8
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		CG_COMP_PICK_ALL(v8);
+		return;
+	}
+#endif
+#if CG_COMP_V4
+	CG_COMP_PICK_ALL(v4);
+#endif
+}
+
 static inline void blend_solid(struct cg_surface_t * surface, enum cg_operator_t op, struct cg_rle_t * rle, uint32_t solid)
 {
 	cg_comp_solid_function_t func = cg_comp_solid_map[op];
@@ -1807,6 +2135,27 @@ static inline void blend_solid(struct cg_surface_t * surface, enum cg_operator_t
 	}
 }
 
+/*
+ * Streaming version of blend_solid(), the rasterizer calls this with each
+ * batch of spans, so they are never copied into a cg_rle_t
+ */
+struct cg_solid_blend_t {
+	struct cg_surface_t * surface;
+	cg_comp_solid_function_t func;
+	uint32_t solid;
+};
+
+static void blend_solid_callback(int count, const XCG_FT_Span * spans, void * user)
+{
+	struct cg_solid_blend_t * b = user;
+	while(count--)
+	{
+		uint32_t * target = (uint32_t *)(b->surface->pixels + spans->y * b->surface->stride) + spans->x;
+		b->func(target, spans->len, b->solid, spans->coverage);
+		++spans;
+	}
+}
+
 static inline void blend_linear_gradient(struct cg_surface_t * surface, enum cg_operator_t op, struct cg_rle_t * rle, struct cg_gradient_data_t * gradient)
 {
 	cg_comp_function_t func = cg_comp_map[op];
@@ -1826,10 +2175,62 @@ static inline void blend_linear_gradient(struct cg_surface_t * surface, enum cg_
 
 	int count = rle->spans.size;
 	struct cg_span_t * spans = rle->spans.data;
+	struct cg_matrix_t * m = &gradient->matrix;
+	/*
+	 * Vertical gradient (constant along a row): the x terms are exactly
+	 * zero, so that's one color per span, which is blended as a solid
+	 * color. Not for CG_OPERATOR_SRC with some coverage, as the solid
+	 * version rounds differently.
+	 */
+	int vertical = (v.l != 0.0) &&
+			((v.dx == 0.0) || (m->a == 0.0)) && ((v.dy == 0.0) || (m->b == 0.0));
+	if(vertical)
+	{
+		cg_comp_solid_function_t sfunc = cg_comp_solid_map[op];
+		while(count--)
+		{
+			uint32_t color;
+			fetch_linear_gradient(&color, &v, gradient, spans->y, spans->x, 1);
+			uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + spans->x;
+			if((op == CG_OPERATOR_SRC) && (spans->coverage != 255))
+			{
+				cg_memfill32(buffer, color, CG_MIN(spans->len, 1024));
+				for(int x = 0; x < spans->len; x += 1024)
+					func(target + x, CG_MIN(spans->len - x, 1024), buffer, spans->coverage);
+			}
+			else if((op != CG_OPERATOR_SRC_OVER) || (color != 0))
+				sfunc(target, spans->len, color, spans->coverage);
+			++spans;
+		}
+		return;
+	}
+	/*
+	 * Horizontal gradient (constant along a column): the y terms are
+	 * exactly zero, so a span fetches the same colors as one with the same
+	 * x and length on another row. The last span fetched is kept, so the
+	 * inside rows of a shape are only fetched once.
+	 */
+	int horizontal = (v.l != 0.0) &&
+			((v.dx == 0.0) || (m->c == 0.0)) && ((v.dy == 0.0) || (m->d == 0.0));
+	uint32_t row[1024];
+	int row_x = 0, row_len = 0;
 	while(count--)
 	{
 		int length = spans->len;
 		int x = spans->x;
+		if(horizontal && (length > 8) && (length <= 1024))
+		{
+			if((x != row_x) || (length != row_len))
+			{
+				fetch_linear_gradient(row, &v, gradient, spans->y, x, length);
+				row_x = x;
+				row_len = length;
+			}
+			uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + x;
+			func(target, length, row, spans->coverage);
+			++spans;
+			continue;
+		}
 		while(length)
 		{
 			int l = CG_MIN(length, 1024);
@@ -2079,57 +2480,88 @@ static inline void cg_blend_color(struct cg_ctx_t * ctx, struct cg_rle_t * rle,
 	}
 }
 
-static inline void cg_blend_gradient(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_gradient_t * gradient)
+static void cg_gradient_build_lut(uint32_t * colortable, struct cg_gradient_t * gradient, double opacity)
 {
-	if(gradient && (gradient->stops.size > 0))
+	int i, pos = 0, nstop = gradient->stops.size;
+	struct cg_gradient_stop_t *curr, *next, *start, *last;
+	uint32_t curr_color, next_color, last_color;
+	uint32_t dist, idist;
+	double delta, t, incr, fpos;
+
+	start = gradient->stops.data;
+	curr = start;
+	curr_color = combine_opacity(&curr->color, opacity);
+
+	colortable[pos] = premultiply_pixel(curr_color);
+	++pos;
+	incr = 1.0 / 1024;
+	fpos = 1.5 * incr;
+
+	while(fpos <= curr->offset)
 	{
-		struct cg_state_t * state = ctx->state;
-		struct cg_gradient_data_t data;
-		int i, pos = 0, nstop = gradient->stops.size;
-		struct cg_gradient_stop_t *curr, *next, *start, *last;
-		uint32_t curr_color, next_color, last_color;
-		uint32_t dist, idist;
-		double delta, t, incr, fpos;
-		double opacity = state->opacity * gradient->opacity;
-
-		start = gradient->stops.data;
-		curr = start;
-		curr_color = combine_opacity(&curr->color, opacity);
-
-		data.colortable[pos] = premultiply_pixel(curr_color);
+		colortable[pos] = colortable[pos - 1];
 		++pos;
-		incr = 1.0 / 1024;
-		fpos = 1.5 * incr;
-
-		while(fpos <= curr->offset)
+		fpos += incr;
+	}
+	for(i = 0; i < nstop - 1; i++)
+	{
+		curr = (start + i);
+		next = (start + i + 1);
+		delta = 1.0 / (next->offset - curr->offset);
+		next_color = combine_opacity(&next->color, opacity);
+		while(fpos < next->offset && pos < 1024)
 		{
-			data.colortable[pos] = data.colortable[pos - 1];
+			t = (fpos - curr->offset) * delta;
+			dist = (uint32_t)(255 * t);
+			idist = 255 - dist;
+			colortable[pos] = premultiply_pixel(interpolate_pixel(curr_color, idist, next_color, dist));
 			++pos;
 			fpos += incr;
 		}
-		for(i = 0; i < nstop - 1; i++)
-		{
-			curr = (start + i);
-			next = (start + i + 1);
-			delta = 1.0 / (next->offset - curr->offset);
-			next_color = combine_opacity(&next->color, opacity);
-			while(fpos < next->offset && pos < 1024)
-			{
-				t = (fpos - curr->offset) * delta;
-				dist = (uint32_t)(255 * t);
-				idist = 255 - dist;
-				data.colortable[pos] = premultiply_pixel(interpolate_pixel(curr_color, idist, next_color, dist));
-				++pos;
-				fpos += incr;
-			}
-			curr_color = next_color;
-		}
+		curr_color = next_color;
+	}
+
+	last = start + nstop - 1;
+	last_color = premultiply_color(&last->color, opacity);
+	for(; pos < 1024; ++pos)
+		colortable[pos] = last_color;
+}
+
+/* Returns the (cached) color table for these stops and opacity */
+static uint32_t * cg_gradient_get_lut(struct cg_ctx_t * ctx, struct cg_gradient_t * gradient, double opacity)
+{
+	size_t size = (size_t)gradient->stops.size * sizeof(struct cg_gradient_stop_t);
+	for(int i = 0; i < CG_GRADIENT_LUT_CACHE; i++)
+	{
+		struct cg_gradient_lut_t * lut = ctx->luts[i];
+		if(lut && (lut->opacity == opacity) && (lut->stops.size == gradient->stops.size) &&
+				!memcmp(lut->stops.data, gradient->stops.data, size))
+			return lut->colortable;
+	}
+	struct cg_gradient_lut_t * lut = ctx->luts[ctx->lut_next];
+	if(!lut)
+	{
+		lut = ctx->luts[ctx->lut_next] = malloc(sizeof(struct cg_gradient_lut_t));
+		cg_array_init(lut->stops);
+	}
+	ctx->lut_next = (ctx->lut_next + 1) % CG_GRADIENT_LUT_CACHE;
+	lut->stops.size = 0;
+	cg_array_ensure(lut->stops, gradient->stops.size);
+	memcpy(lut->stops.data, gradient->stops.data, size);
+	lut->stops.size = gradient->stops.size;
+	lut->opacity = opacity;
+	cg_gradient_build_lut(lut->colortable, gradient, opacity);
+	return lut->colortable;
+}
 
-		last = start + nstop - 1;
-		last_color = premultiply_color(&last->color, opacity);
-		for(; pos < 1024; ++pos)
-			data.colortable[pos] = last_color;
+static inline void cg_blend_gradient(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_gradient_t * gradient)
+{
+	if(gradient && (gradient->stops.size > 0))
+	{
+		struct cg_state_t * state = ctx->state;
+		struct cg_gradient_data_t data;
 
+		data.colortable = cg_gradient_get_lut(ctx, gradient, state->opacity * gradient->opacity);
 		data.spread = gradient->spread;
 		data.matrix = gradient->matrix;
 		cg_matrix_multiply(&data.matrix, &data.matrix, &state->matrix);
@@ -2188,6 +2620,27 @@ static inline void cg_blend_texture(struct cg_ctx_t * ctx, struct cg_rle_t * rle
 	}
 }
 
+/*
+ * Solid colors with no clip path or clip boxes don't need the spans to be
+ * kept around, they are blended as the rasterizer makes them. Same pixels
+ * as cg_rle_rasterize() + cg_blend(), but ctx->rle isn't updated.
+ */
+static int cg_fill_streamed(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding)
+{
+	struct cg_state_t * state = ctx->state;
+	if((state->paint.type != CG_PAINT_TYPE_COLOR) || state->clippath || state->boxes.size)
+		return 0;
+	struct cg_solid_blend_t b;
+	enum cg_operator_t op = state->op;
+	b.surface = ctx->surface;
+	b.solid = premultiply_color(&state->paint.color, state->opacity);
+	if((CG_ALPHA(b.solid) == 255) && (op == CG_OPERATOR_SRC_OVER))
+		op = CG_OPERATOR_SRC;
+	b.func = cg_comp_solid_map[op];
+	cg_rasterize(ctx, blend_solid_callback, &b, path, m, &state->scissor, stroke, winding);
+	return 1;
+}
+
 static void cg_blend(struct cg_ctx_t * ctx, struct cg_rle_t * rle)
 {
 	if(rle && (rle->spans.size > 0))
@@ -2209,10 +2662,11 @@ static void cg_blend(struct cg_ctx_t * ctx, struct cg_rle_t * rle)
 	}
 }
 
-static struct cg_state_t * cg_state_create(void)
+static struct cg_state_t * cg_state_create(struct cg_arena_t * arena)
 {
-	struct cg_state_t * state = malloc(sizeof(struct cg_state_t));
+	struct cg_state_t * state = cg_arena_alloc(arena, sizeof(struct cg_state_t));
 	state->clippath = NULL;
+	cg_array_init(state->boxes);
 	cg_paint_init(&state->paint);
 	cg_matrix_init_identity(&state->matrix);
 	state->winding = CG_FILL_RULE_NON_ZERO;
@@ -2227,10 +2681,15 @@ static struct cg_state_t * cg_state_create(void)
 	return state;
 }
 
-static struct cg_state_t * cg_state_clone(struct cg_state_t * state)
+static struct cg_state_t * cg_state_clone(struct cg_arena_t * arena, struct cg_state_t * state)
 {
-	struct cg_state_t * newstate = cg_state_create();
+	struct cg_state_t * newstate = cg_state_create(arena);
 	newstate->clippath = cg_rle_clone(state->clippath);
+	newstate->scissor = state->scissor;
+	cg_array_ensure(newstate->boxes, state->boxes.size);
+	if(state->boxes.size)
+		memcpy(newstate->boxes.data, state->boxes.data, (size_t)state->boxes.size * sizeof(struct cg_box_t));
+	newstate->boxes.size = state->boxes.size;
 	cg_paint_copy(&newstate->paint, &state->paint);
 	newstate->matrix = state->matrix;
 	newstate->winding = state->winding;
@@ -2238,35 +2697,567 @@ static struct cg_state_t * cg_state_clone(struct cg_state_t * state)
 	newstate->stroke.miterlimit = state->stroke.miterlimit;
 	newstate->stroke.cap = state->stroke.cap;
 	newstate->stroke.join = state->stroke.join;
-	newstate->stroke.dash = cg_dash_clone(state->stroke.dash);
+	newstate->stroke.dash = cg_dash_clone(arena, state->stroke.dash);
 	newstate->op = state->op;
 	newstate->opacity = state->opacity;
 	newstate->next = NULL;
 	return newstate;
 }
 
-static void cg_state_destroy(struct cg_state_t * state)
+static void cg_state_destroy(struct cg_arena_t * arena, struct cg_state_t * state)
 {
 	cg_rle_destroy(state->clippath);
+	free(state->boxes.data);
 	cg_paint_destroy(&state->paint);
-	cg_dash_destroy(state->stroke.dash);
-	free(state);
+	cg_dash_destroy(arena, state->stroke.dash);
+	cg_arena_free(arena, state);
 }
 
-struct cg_ctx_t * cg_create(struct cg_surface_t * surface)
+/*
+ * Display lists, see cg.h for the format.
+ */
+struct cg_dl_header_t {
+	uint32_t op;
+	uint32_t size;
+};
+
+static void cg_dl_put(struct cg_dlist_t * dl, const void * data, size_t size)
 {
-	struct cg_ctx_t * ctx = malloc(sizeof(struct cg_ctx_t));
-	ctx->surface = cg_surface_reference(surface);
-	ctx->state = cg_state_create();
-	ctx->path = cg_path_create();
+	cg_array_ensure(dl->cmds, (int)size);
+	memcpy(dl->cmds.data + dl->cmds.size, data, size);
+	dl->cmds.size += (int)size;
+}
+
+static void cg_dl_put_int(struct cg_dlist_t * dl, int32_t v)
+{
+	cg_dl_put(dl, &v, sizeof(v));
+}
+
+static void cg_dl_put_double(struct cg_dlist_t * dl, double v)
+{
+	cg_dl_put(dl, &v, sizeof(v));
+}
+
+static void cg_dl_put_matrix(struct cg_dlist_t * dl, struct cg_matrix_t * m)
+{
+	double v[6] = { m->a, m->b, m->c, m->d, m->tx, m->ty };
+	cg_dl_put(dl, v, sizeof(v));
+}
+
+/* Starts a command, returns its offset for cg_dl_end() */
+static int cg_dl_begin(struct cg_dlist_t * dl, enum cg_dlist_op_t op)
+{
+	int offset = dl->cmds.size;
+	struct cg_dl_header_t h = { .op = op, .size = 0 };
+	cg_dl_put(dl, &h, sizeof(h));
+	return offset;
+}
+
+/*
+ * Pads and finishes the command. If 'last' is given, and the command is the
+ * same as the one it points to, it's dropped.
+ */
+static void cg_dl_end(struct cg_dlist_t * dl, int offset, int * last)
+{
+	static const unsigned char zero[8];
+	int pad = (8 - (dl->cmds.size & 7)) & 7;
+	cg_dl_put(dl, zero, pad);
+	struct cg_dl_header_t * h = (struct cg_dl_header_t *)(dl->cmds.data + offset);
+	h->size = dl->cmds.size - offset - sizeof(*h);
+	if(!last)
+		return;
+	if(*last >= 0)
+	{
+		struct cg_dl_header_t * l = (struct cg_dl_header_t *)(dl->cmds.data + *last);
+		if((l->op == h->op) && (l->size == h->size) && !memcmp(l + 1, h + 1, h->size))
+		{
+			dl->cmds.size = offset;
+			return;
+		}
+	}
+	*last = offset;
+}
+
+static void cg_dl_record(struct cg_dlist_t * dl, enum cg_dlist_op_t op)
+{
+	cg_dl_end(dl, cg_dl_begin(dl, op), NULL);
+}
+
+static void cg_dl_record_state(struct cg_dlist_t * dl, struct cg_state_t * state)
+{
+	struct cg_dash_t * dash = state->stroke.dash;
+	int offset = cg_dl_begin(dl, CG_DL_STATE);
+	cg_dl_put_int(dl, state->op);
+	cg_dl_put_int(dl, state->winding);
+	cg_dl_put_int(dl, state->stroke.cap);
+	cg_dl_put_int(dl, state->stroke.join);
+	cg_dl_put_int(dl, dash ? dash->size : 0);
+	cg_dl_put_int(dl, 0);
+	cg_dl_put_matrix(dl, &state->matrix);
+	cg_dl_put_double(dl, state->opacity);
+	cg_dl_put_double(dl, state->stroke.width);
+	cg_dl_put_double(dl, state->stroke.miterlimit);
+	cg_dl_put_double(dl, dash ? dash->offset : 0.0);
+	if(dash)
+		cg_dl_put(dl, dash->data, (size_t)dash->size * sizeof(double));
+	cg_dl_end(dl, offset, &dl->last_state);
+}
+
+static void cg_dl_record_source(struct cg_dlist_t * dl, struct cg_paint_t * paint)
+{
+	int offset;
+	switch(paint->type)
+	{
+	case CG_PAINT_TYPE_COLOR:
+		offset = cg_dl_begin(dl, CG_DL_COLOR);
+		cg_dl_put_double(dl, paint->color.r);
+		cg_dl_put_double(dl, paint->color.g);
+		cg_dl_put_double(dl, paint->color.b);
+		cg_dl_put_double(dl, paint->color.a);
+		break;
+	case CG_PAINT_TYPE_GRADIENT:
+	{
+		struct cg_gradient_t * g = &paint->gradient;
+		offset = cg_dl_begin(dl, CG_DL_GRADIENT);
+		cg_dl_put_int(dl, g->type);
+		cg_dl_put_int(dl, g->spread);
+		cg_dl_put_int(dl, g->stops.size);
+		cg_dl_put_int(dl, 0);
+		cg_dl_put_matrix(dl, &g->matrix);
+		cg_dl_put(dl, g->values, sizeof(g->values));
+		cg_dl_put_double(dl, g->opacity);
+		for(int i = 0; i < g->stops.size; i++)
+		{
+			struct cg_gradient_stop_t * s = &g->stops.data[i];
+			double v[5] = { s->offset, s->color.r, s->color.g, s->color.b, s->color.a };
+			cg_dl_put(dl, v, sizeof(v));
+		}
+	}	break;
+	case CG_PAINT_TYPE_TEXTURE:
+	{
+		struct cg_texture_t * t = &paint->texture;
+		int index = 0;
+		while((index < dl->surfaces.size) && (dl->surfaces.data[index] != t->surface))
+			index++;
+		if(index == dl->surfaces.size)
+		{
+			cg_array_ensure(dl->surfaces, 1);
+			dl->surfaces.data[dl->surfaces.size++] = cg_surface_reference(t->surface);
+		}
+		offset = cg_dl_begin(dl, CG_DL_TEXTURE);
+		cg_dl_put_int(dl, t->type);
+		cg_dl_put_int(dl, index);
+		cg_dl_put_matrix(dl, &t->matrix);
+		cg_dl_put_double(dl, t->opacity);
+	}	break;
+	default:
+		return;
+	}
+	cg_dl_end(dl, offset, &dl->last_source);
+}
+
+static void cg_dl_record_path(struct cg_dlist_t * dl, struct cg_path_t * path)
+{
+	int offset = cg_dl_begin(dl, CG_DL_PATH);
+	cg_dl_put_int(dl, path->elements.size);
+	cg_dl_put_int(dl, path->points.size);
+	cg_dl_put_int(dl, path->contours);
+	cg_dl_put_int(dl, 0);
+	cg_dl_put_double(dl, path->start.x);
+	cg_dl_put_double(dl, path->start.y);
+	for(int i = 0; i < path->elements.size; i++)
+		cg_dl_put_int(dl, path->elements.data[i]);
+	if(path->elements.size & 1)
+		cg_dl_put_int(dl, 0);
+	for(int i = 0; i < path->points.size; i++)
+	{
+		cg_dl_put_double(dl, path->points.data[i].x);
+		cg_dl_put_double(dl, path->points.data[i].y);
+	}
+	cg_dl_end(dl, offset, &dl->last_path);
+}
+
+/* fill, stroke, paint and clip, with what they use */
+static void cg_dl_record_draw(struct cg_ctx_t * ctx, enum cg_dlist_op_t op)
+{
+	struct cg_dlist_t * dl = ctx->dlist;
+	cg_dl_record_state(dl, ctx->state);
+	if(op != CG_DL_CLIP)
+		cg_dl_record_source(dl, &ctx->state->paint);
+	if(op != CG_DL_PAINT)
+		cg_dl_record_path(dl, ctx->path);
+	cg_dl_record(dl, op);
+}
+
+/* cg_save()/cg_restore() are replayed, so what was recorded before is stale */
+static void cg_dl_record_save(struct cg_dlist_t * dl, enum cg_dlist_op_t op)
+{
+	cg_dl_record(dl, op);
+	dl->last_state = -1;
+	dl->last_source = -1;
+}
+
+struct cg_dlist_t * cg_dlist_create(void)
+{
+	struct cg_dlist_t * dl = malloc(sizeof(struct cg_dlist_t));
+	cg_array_init(dl->cmds);
+	cg_array_init(dl->surfaces);
+	cg_dlist_clear(dl);
+	return dl;
+}
+
+void cg_dlist_destroy(struct cg_dlist_t * dl)
+{
+	if(dl)
+	{
+		cg_dlist_clear(dl);
+		free(dl->cmds.data);
+		free(dl->surfaces.data);
+		free(dl);
+	}
+}
+
+void cg_dlist_clear(struct cg_dlist_t * dl)
+{
+	for(int i = 0; i < dl->surfaces.size; i++)
+		cg_surface_destroy(dl->surfaces.data[i]);
+	dl->surfaces.size = 0;
+	dl->cmds.size = 0;
+	dl->last_state = dl->last_source = dl->last_path = -1;
+	int offset = cg_dl_begin(dl, CG_DL_HEADER);
+	cg_dl_put_int(dl, CG_DLIST_MAGIC);
+	cg_dl_put_int(dl, CG_DLIST_VERSION);
+	cg_dl_end(dl, offset, NULL);
+}
+
+/* Record to 'dl' (appended to what's there already) until cg_dlist_end() */
+void cg_dlist_begin(struct cg_ctx_t * ctx, struct cg_dlist_t * dl)
+{
+	ctx->dlist = dl;
+	dl->last_state = dl->last_source = dl->last_path = -1;
+}
+
+void cg_dlist_end(struct cg_ctx_t * ctx)
+{
+	ctx->dlist = NULL;
+}
+
+const void * cg_dlist_get_data(struct cg_dlist_t * dl, size_t * size)
+{
+	if(size)
+		*size = dl->cmds.size;
+	return dl->cmds.data;
+}
+
+/*
+ * Returns 1 if a command's payload holds everything replay reads from it:
+ * the fixed part, then the counts it carries. Paths also have to be what
+ * the cg_path functions would have made, as the flattening and the outline
+ * conversion trust the points and contours counts.
+ */
+static int cg_dl_check(struct cg_dl_header_t * h, int32_t * i)
+{
+	size_t size = h->size;
+	switch(h->op)
+	{
+	case CG_DL_STATE:
+		return (size >= 104) && (i[4] >= 0) && ((size_t)i[4] <= (size - 104) / 8);
+	case CG_DL_COLOR:
+	case CG_DL_SCISSOR:
+		return size >= 32;
+	case CG_DL_GRADIENT:
+		return (size >= 120) && (i[2] >= 0) && ((size_t)i[2] <= (size - 120) / 40);
+	case CG_DL_TEXTURE:
+		return (size >= 64) && (i[1] >= 0);
+	case CG_DL_PATH:
+	{
+		if(size < 32)
+			return 0;
+		int nelements = i[0], npoints = i[1];
+		if((nelements < 0) || (npoints < 0) ||
+				((size_t)nelements + (nelements & 1) > (size - 32) / 4))
+			return 0;
+		size -= 32 + ((size_t)nelements + (nelements & 1)) * 4;
+		if((size_t)npoints > size / 16)
+			return 0;
+		int32_t * e = i + 8;
+		int points = 0, contours = 0;
+		for(int k = 0; k < nelements; k++)
+		{
+			if((e[k] < CG_PATH_ELEMENT_MOVE_TO) || (e[k] > CG_PATH_ELEMENT_CLOSE))
+				return 0;
+			points += e[k] == CG_PATH_ELEMENT_CURVE_TO ? 3 : 1;
+			contours += e[k] == CG_PATH_ELEMENT_MOVE_TO;
+		}
+		return (points == npoints) && (contours == i[2]);
+	}
+	case CG_DL_CLIP_BOXES:
+		return (size >= 8) && ((i[0] <= 0) || ((size_t)i[0] <= (size - 8) / sizeof(struct cg_box_t)));
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Maps a recorded device space box (x1, y1, x2, y2) through the replay's
+ * base matrix. Returns 0 if it doesn't stay a pixel aligned box, or would
+ * be flipped (boxes have to stay in y-x banded order).
+ */
+static int cg_dl_map_box(struct cg_matrix_t * m, double b[4])
+{
+	if((m->b != 0.0) || (m->c != 0.0) || (m->a <= 0.0) || (m->d <= 0.0))
+		return 0;
+	b[0] = b[0] * m->a + m->tx;
+	b[1] = b[1] * m->d + m->ty;
+	b[2] = b[2] * m->a + m->tx;
+	b[3] = b[3] * m->d + m->ty;
+	for(int k = 0; k < 4; k++)
+		if((b[k] != floor(b[k])) || (fabs(b[k]) > (1 << 22)))
+			return 0;
+	return 1;
+}
+
+/* Clip to 'clip' (recorded device space boxes) drawn through 'base' */
+static void cg_dl_clip_path(struct cg_ctx_t * ctx, struct cg_matrix_t * base, struct cg_path_t * clip)
+{
+	struct cg_state_t * state = ctx->state;
+	struct cg_path_t * path = ctx->path;
+	struct cg_matrix_t matrix = state->matrix;
+	enum cg_fill_rule_t winding = state->winding;
+	ctx->path = clip;
+	state->matrix = *base;
+	state->winding = CG_FILL_RULE_NON_ZERO;
+	cg_clip_preserve(ctx);
+	ctx->path = path;
+	state->matrix = matrix;
+	state->winding = winding;
+}
+
+/*
+ * Recorded matrices are applied on top of the context's matrix at the time
+ * of the replay, so the list can be drawn at another position or scale.
+ * Clips (scissor and boxes) are recorded in device space, they go through
+ * that matrix too: if they stay pixel aligned, they are just mapped;
+ * otherwise they are clipped as a path. Note that such a path clip adds to
+ * the previous boxes, rather than replacing them like cg_clip_boxes().
+ * The context's state and path are left as they were.
+ */
+void cg_dlist_replay(struct cg_ctx_t * ctx, struct cg_dlist_t * dl)
+{
+	struct cg_matrix_t base = ctx->state->matrix;
+	int identity = (base.a == 1.0) && (base.b == 0.0) && (base.c == 0.0) &&
+			(base.d == 1.0) && (base.tx == 0.0) && (base.ty == 0.0);
+	struct cg_path_t * clip = NULL;
+	struct {
+		struct cg_box_t * data;
+		int size;
+		int capacity;
+	} boxes;
+	cg_array_init(boxes);
+	struct cg_path_t * path = ctx->path;
+	ctx->path = cg_path_create();
+	cg_save(ctx);
+	int depth = 0;
+	unsigned char * p = dl->cmds.data;
+	unsigned char * end = p + dl->cmds.size;
+	while(p + sizeof(struct cg_dl_header_t) <= end)
+	{
+		struct cg_dl_header_t h;
+		memcpy(&h, p, sizeof(h));
+		int32_t * i = (int32_t *)(p + sizeof(h));
+		/* a damaged list stops here, rather than reading past a payload */
+		if((h.size > (size_t)(end - p) - sizeof(h)) || !cg_dl_check(&h, i))
+			break;
+		p += sizeof(h) + h.size;
+		switch(h.op)
+		{
+		case CG_DL_SAVE:
+			cg_save(ctx);
+			depth++;
+			break;
+		case CG_DL_RESTORE:
+			if(depth)
+			{
+				cg_restore(ctx);
+				depth--;
+			}
+			break;
+		case CG_DL_STATE:
+		{
+			struct cg_state_t * state = ctx->state;
+			double * d = (double *)(i + 6);
+			struct cg_matrix_t m;
+			cg_matrix_init(&m, d[0], d[1], d[2], d[3], d[4], d[5]);
+			cg_matrix_multiply(&state->matrix, &m, &base);
+			state->op = i[0];
+			state->winding = i[1];
+			state->stroke.cap = i[2];
+			state->stroke.join = i[3];
+			state->opacity = d[6];
+			state->stroke.width = d[7];
+			state->stroke.miterlimit = d[8];
+			cg_set_dash(ctx, i[4] ? d + 10 : NULL, i[4], d[9]);
+		}	break;
+		case CG_DL_COLOR:
+		{
+			double * d = (double *)i;
+			cg_set_source_rgba(ctx, d[0], d[1], d[2], d[3]);
+		}	break;
+		case CG_DL_GRADIENT:
+		{
+			double * d = (double *)(i + 4);
+			struct cg_gradient_t * g = i[0] == CG_GRADIENT_TYPE_LINEAR ?
+					cg_set_source_linear_gradient(ctx, d[6], d[7], d[8], d[9]) :
+					cg_set_source_radial_gradient(ctx, d[6], d[7], d[8], d[9], d[10], d[11]);
+			struct cg_matrix_t m;
+			cg_matrix_init(&m, d[0], d[1], d[2], d[3], d[4], d[5]);
+			cg_gradient_set_matrix(g, &m);
+			cg_gradient_set_spread(g, i[1]);
+			cg_gradient_set_opacity(g, d[12]);
+			cg_gradient_clear_stops(g);
+			for(int s = 0; s < i[2]; s++)
+			{
+				double * v = d + 13 + (s * 5);
+				cg_gradient_add_stop_rgba(g, v[0], v[1], v[2], v[3], v[4]);
+			}
+		}	break;
+		case CG_DL_TEXTURE:
+		{
+			double * d = (double *)(i + 2);
+			if(i[1] >= dl->surfaces.size)
+				break;
+			struct cg_texture_t * t = &ctx->state->paint.texture;
+			ctx->state->paint.type = CG_PAINT_TYPE_TEXTURE;
+			cg_texture_init(t, dl->surfaces.data[i[1]], i[0]);
+			cg_matrix_init(&t->matrix, d[0], d[1], d[2], d[3], d[4], d[5]);
+			cg_texture_set_opacity(t, d[6]);
+		}	break;
+		case CG_DL_PATH:
+		{
+			struct cg_path_t * cp = ctx->path;
+			int nelements = i[0], npoints = i[1];
+			double * d = (double *)(i + 4);
+			int32_t * e = (int32_t *)(d + 2);
+			double * pt = (double *)(e + nelements + (nelements & 1));
+			cg_path_clear(cp);
+			cg_array_ensure(cp->elements, nelements);
+			cg_array_ensure(cp->points, npoints);
+			for(int k = 0; k < nelements; k++)
+				cp->elements.data[k] = e[k];
+			for(int k = 0; k < npoints; k++)
+			{
+				cp->points.data[k].x = pt[k * 2];
+				cp->points.data[k].y = pt[k * 2 + 1];
+			}
+			cp->elements.size = nelements;
+			cp->points.size = npoints;
+			cp->contours = i[2];
+			cp->start.x = d[0];
+			cp->start.y = d[1];
+		}	break;
+		case CG_DL_FILL:
+			cg_fill_preserve(ctx);
+			break;
+		case CG_DL_STROKE:
+			cg_stroke_preserve(ctx);
+			break;
+		case CG_DL_PAINT:
+			cg_paint(ctx);
+			break;
+		case CG_DL_CLIP:
+			cg_clip_preserve(ctx);
+			break;
+		case CG_DL_RESET_CLIP:
+			cg_reset_clip(ctx);
+			break;
+		case CG_DL_SCISSOR:
+		{
+			double * d = (double *)i;
+			double b[4] = { d[0], d[1], d[0] + d[2], d[1] + d[3] };
+			if(identity)
+				cg_scissor(ctx, d[0], d[1], d[2], d[3]);
+			else if(cg_dl_map_box(&base, b))
+				cg_scissor(ctx, b[0], b[1], b[2] - b[0], b[3] - b[1]);
+			else
+			{
+				if(!clip)
+					clip = cg_path_create();
+				cg_path_clear(clip);
+				cg_path_add_rectangle(clip, d[0], d[1], d[2], d[3]);
+				cg_dl_clip_path(ctx, &base, clip);
+			}
+		}	break;
+		case CG_DL_CLIP_BOXES:
+		{
+			struct cg_box_t * r = (struct cg_box_t *)(i + 2);
+			int count = i[0];
+			if(identity || (count <= 0))
+			{
+				cg_clip_boxes(ctx, r, count);
+				break;
+			}
+			cg_array_ensure(boxes, count);
+			for(boxes.size = 0; boxes.size < count; boxes.size++)
+			{
+				struct cg_box_t * s = &r[boxes.size];
+				double b[4] = { s->x1, s->y1, s->x2, s->y2 };
+				if(!cg_dl_map_box(&base, b))
+					break;
+				boxes.data[boxes.size] = (struct cg_box_t){ b[0], b[1], b[2], b[3] };
+			}
+			if(boxes.size == count)
+			{
+				cg_clip_boxes(ctx, boxes.data, count);
+				break;
+			}
+			if(!clip)
+				clip = cg_path_create();
+			cg_path_clear(clip);
+			for(int k = 0; k < count; k++)
+				cg_path_add_rectangle(clip, r[k].x1, r[k].y1,
+						r[k].x2 - r[k].x1, r[k].y2 - r[k].y1);
+			cg_dl_clip_path(ctx, &base, clip);
+		}	break;
+		default:
+			break;
+		}
+	}
+	while(depth--)
+		cg_restore(ctx);
+	cg_restore(ctx);
+	cg_path_destroy(ctx->path);
+	ctx->path = path;
+	if(clip)
+		cg_path_destroy(clip);
+	free(boxes.data);
+}
+
+struct cg_ctx_t * cg_create(struct cg_surface_t * surface)
+{
+	struct cg_ctx_t * ctx = malloc(sizeof(struct cg_ctx_t));
+	ctx->surface = cg_surface_reference(surface);
+	memset(&ctx->arena, 0, sizeof(ctx->arena));
+	ctx->arena.data = malloc(CG_ARENA_SIZE);
+	ctx->arena.stats.size = CG_ARENA_SIZE;
+	/* the bottom state stays for good, so it's not from the arena */
+	ctx->state = cg_state_create(NULL);
+	ctx->path = cg_path_create();
 	ctx->rle = cg_rle_create();
+	ctx->spare = cg_rle_create();
 	ctx->clippath = NULL;
 	ctx->clip.x = 0.0;
 	ctx->clip.y = 0.0;
 	ctx->clip.w = surface->width;
 	ctx->clip.h = surface->height;
+	ctx->state->scissor = ctx->clip;
 	ctx->outline_data = NULL;
 	ctx->outline_size = 0;
+	memset(&ctx->raster_pool, 0, sizeof(ctx->raster_pool));
+	ctx->stroker = NULL;
+	memset(ctx->luts, 0, sizeof(ctx->luts));
+	ctx->lut_next = 0;
+	ctx->dlist = NULL;
+	ctx->raster_threads = 0;
 	return ctx;
 }
 
@@ -2278,30 +3269,46 @@ void cg_destroy(struct cg_ctx_t * ctx)
 		{
 			struct cg_state_t * state = ctx->state;
 			ctx->state = state->next;
-			cg_state_destroy(state);
+			cg_state_destroy(&ctx->arena, state);
 		}
 		cg_surface_destroy(ctx->surface);
 		cg_path_destroy(ctx->path);
 		cg_rle_destroy(ctx->rle);
+		cg_rle_destroy(ctx->spare);
 		cg_rle_destroy(ctx->clippath);
 		if(ctx->outline_data)
 			free(ctx->outline_data);
+		XCG_FT_Raster_Pool_Done(&ctx->raster_pool);
+		XCG_FT_Stroker_Done(ctx->stroker);
+		free(ctx->arena.data);
+		for(int i = 0; i < CG_GRADIENT_LUT_CACHE; i++)
+		{
+			if(ctx->luts[i])
+			{
+				free(ctx->luts[i]->stops.data);
+				free(ctx->luts[i]);
+			}
+		}
 		free(ctx);
 	}
 }
 
 void cg_save(struct cg_ctx_t * ctx)
 {
-	struct cg_state_t * state = cg_state_clone(ctx->state);
+	if(ctx->dlist)
+		cg_dl_record_save(ctx->dlist, CG_DL_SAVE);
+	struct cg_state_t * state = cg_state_clone(&ctx->arena, ctx->state);
 	state->next = ctx->state;
 	ctx->state = state;
 }
 
 void cg_restore(struct cg_ctx_t * ctx)
 {
+	if(ctx->dlist)
+		cg_dl_record_save(ctx->dlist, CG_DL_RESTORE);
 	struct cg_state_t * state = ctx->state;
 	ctx->state = state->next;
-	cg_state_destroy(state);
+	cg_state_destroy(&ctx->arena, state);
 }
 
 struct cg_color_t * cg_set_source_rgb(struct cg_ctx_t * ctx, double r, double g, double b)
@@ -2390,8 +3397,8 @@ void cg_set_miter_limit(struct cg_ctx_t * ctx, double limit)
 
 void cg_set_dash(struct cg_ctx_t * ctx, double * dashes, int ndash, double offset)
 {
-	cg_dash_destroy(ctx->state->stroke.dash);
-	ctx->state->stroke.dash = cg_dash_create(dashes, ndash, offset);
+	cg_dash_destroy(&ctx->arena, ctx->state->stroke.dash);
+	ctx->state->stroke.dash = cg_dash_create(NULL, dashes, ndash, offset);
 }
 
 void cg_translate(struct cg_ctx_t * ctx, double tx, double ty)
@@ -2506,8 +3513,87 @@ void cg_close_path(struct cg_ctx_t * ctx)
 
 void cg_reset_clip(struct cg_ctx_t * ctx)
 {
+	if(ctx->dlist)
+	{
+		cg_dl_record(ctx->dlist, CG_DL_RESET_CLIP);
+		return;
+	}
 	cg_rle_destroy(ctx->state->clippath);
 	ctx->state->clippath = NULL;
+	ctx->state->boxes.size = 0;
+	ctx->state->scissor = ctx->clip;
+}
+
+/*
+ * Pixel aligned rectangular clip, that is intersected with the current
+ * one. Unlike cg_clip(), nothing is rasterized, the rasterizer is just
+ * told to ignore anything outside of it.
+ */
+void cg_scissor(struct cg_ctx_t * ctx, double x, double y, double w, double h)
+{
+	if(ctx->dlist)
+	{
+		int offset = cg_dl_begin(ctx->dlist, CG_DL_SCISSOR);
+		double v[4] = { x, y, w, h };
+		cg_dl_put(ctx->dlist, v, sizeof(v));
+		cg_dl_end(ctx->dlist, offset, NULL);
+		return;
+	}
+	struct cg_rect_t * s = &ctx->state->scissor;
+	double x1 = CG_MAX(s->x, x);
+	double y1 = CG_MAX(s->y, y);
+	double x2 = CG_MIN(s->x + s->w, x + w);
+	double y2 = CG_MIN(s->y + s->h, y + h);
+	s->x = x1;
+	s->y = y1;
+	s->w = CG_MAX(x2 - x1, 0.0);
+	s->h = CG_MAX(y2 - y1, 0.0);
+}
+
+/*
+ * Clip to the union of 'boxes' (see struct cg_box_t), replacing any
+ * previous box list; the scissor is also intersected with their extents.
+ * Spans are clipped against the boxes directly, so unlike cg_clip() of the
+ * same rectangles, nothing is rasterized. The boxes are copied.
+ */
+void cg_clip_boxes(struct cg_ctx_t * ctx, const struct cg_box_t * boxes, int count)
+{
+	if(ctx->dlist)
+	{
+		int offset = cg_dl_begin(ctx->dlist, CG_DL_CLIP_BOXES);
+		cg_dl_put_int(ctx->dlist, count);
+		cg_dl_put_int(ctx->dlist, 0);
+		if(count > 0)
+			cg_dl_put(ctx->dlist, boxes, (size_t)count * sizeof(struct cg_box_t));
+		cg_dl_end(ctx->dlist, offset, NULL);
+		return;
+	}
+	struct cg_state_t * state = ctx->state;
+	state->boxes.size = 0;
+	if(count <= 0)
+	{
+		cg_scissor(ctx, 0, 0, 0, 0);
+		return;
+	}
+	cg_array_ensure(state->boxes, count);
+	memcpy(state->boxes.data, boxes, (size_t)count * sizeof(struct cg_box_t));
+	state->boxes.size = count;
+	int x1 = INT_MAX, x2 = INT_MIN;
+	for(int i = 0; i < count; i++)
+	{
+		x1 = CG_MIN(x1, boxes[i].x1);
+		x2 = CG_MAX(x2, boxes[i].x2);
+	}
+	cg_scissor(ctx, x1, boxes[0].y1, x2 - x1, boxes[count - 1].y2 - boxes[0].y1);
+}
+
+/* Apply the clip path and clip boxes (if any) to ctx->rle */
+static void cg_clip_ctx_rle(struct cg_ctx_t * ctx)
+{
+	struct cg_state_t * state = ctx->state;
+	cg_rle_clip_path(ctx->rle, state->clippath, ctx->spare);
+	if(state->boxes.size)
+		cg_rle_clip_boxes(ctx->rle, ctx->spare, state->boxes.data, state->boxes.size);
 }
 
 void cg_clip(struct cg_ctx_t * ctx)
@@ -2518,18 +3604,320 @@ void cg_clip(struct cg_ctx_t * ctx)
 
 void cg_clip_preserve(struct cg_ctx_t * ctx)
 {
+	if(ctx->dlist)
+	{
+		cg_dl_record_draw(ctx, CG_DL_CLIP);
+		return;
+	}
 	struct cg_state_t * state = ctx->state;
 	if(state->clippath)
 	{
 		cg_rle_clear(ctx->rle);
-		cg_rle_rasterize(ctx, ctx->rle, ctx->path, &state->matrix, &ctx->clip, NULL, state->winding);
-		cg_rle_clip_path(state->clippath, ctx->rle);
+		cg_rle_rasterize(ctx, ctx->rle, ctx->path, &state->matrix, &state->scissor, NULL, state->winding);
+		cg_rle_clip_path(state->clippath, ctx->rle, ctx->spare);
 	}
 	else
 	{
 		state->clippath = cg_rle_create();
-		cg_rle_rasterize(ctx, state->clippath, ctx->path, &state->matrix, &ctx->clip, NULL, state->winding);
+		cg_rle_rasterize(ctx, state->clippath, ctx->path, &state->matrix, &state->scissor, NULL, state->winding);
+	}
+}
+
+/*
+ * Returns 1 if the path is a single closed rectangle that stays axis
+ * aligned with 'm', with its device corners in b (x1, y1, x2, y2).
+ */
+static int cg_path_device_box(struct cg_path_t * path, struct cg_matrix_t * m, double b[4])
+{
+	if((path->contours != 1) || (m->b != 0.0) || (m->c != 0.0))
+		return 0;
+	enum cg_path_element_t * e = path->elements.data;
+	int n = path->elements.size;
+	if((n < 5) || (n > 6) || (e[0] != CG_PATH_ELEMENT_MOVE_TO))
+		return 0;
+	for(int i = 1; i < 4; i++)
+		if(e[i] != CG_PATH_ELEMENT_LINE_TO)
+			return 0;
+	if(!((n == 5 && e[4] == CG_PATH_ELEMENT_CLOSE) ||
+			(n == 6 && e[4] == CG_PATH_ELEMENT_LINE_TO && e[5] == CG_PATH_ELEMENT_CLOSE)))
+		return 0;
+	struct cg_point_t p[5];
+	for(int i = 0; i < 5; i++)
+		cg_matrix_map_point(m, &path->points.data[i], &p[i]);
+	if((p[4].x != p[0].x) || (p[4].y != p[0].y))
+		return 0;
+	if(!((p[0].y == p[1].y && p[1].x == p[2].x && p[2].y == p[3].y && p[3].x == p[0].x) ||
+			(p[0].x == p[1].x && p[1].y == p[2].y && p[2].x == p[3].x && p[3].y == p[0].y)))
+		return 0;
+	b[0] = CG_MIN(p[0].x, p[2].x);
+	b[1] = CG_MIN(p[0].y, p[2].y);
+	b[2] = CG_MAX(p[0].x, p[2].x);
+	b[3] = CG_MAX(p[0].y, p[2].y);
+	return 1;
+}
+
+/* Clips device box b to 'clip', if it is on pixel boundaries */
+static int cg_box_clip_int(double b[4], struct cg_rect_t * clip, int r[4])
+{
+	for(int i = 0; i < 4; i++)
+		if((b[i] != (int)b[i]) || (fabs(b[i]) > (1 << 22)))
+			return 0;
+	r[0] = CG_MAX((int)b[0], (int)clip->x);
+	r[1] = CG_MAX((int)b[1], (int)clip->y);
+	r[2] = CG_MIN((int)b[2], (int)(clip->x + clip->w));
+	r[3] = CG_MIN((int)b[3], (int)(clip->y + clip->h));
+	return 1;
+}
+
+/*
+ * Most of what libmui fills are pixel aligned rectangles (cg_rectangle()
+ * with integer coordinates, and no rotation/skew). These don't need the
+ * rasterizer at all: returns 1 with the device rectangle, clipped to
+ * 'clip' the same way the rasterizer does it. Returns 0 if the path isn't
+ * such a rectangle.
+ */
+static int cg_path_device_rect(struct cg_path_t * path, struct cg_matrix_t * m, struct cg_rect_t * clip, int r[4])
+{
+	double b[4];
+	return cg_path_device_box(path, m, b) && cg_box_clip_int(b, clip, r);
+}
+
+/*
+ * Same idea for strokes: the 1 and 2 pixel frames and separators libmui
+ * draws are axis aligned rectangles and lines, and when the stroke edges
+ * land on pixel boundaries, they are a few rectangles. Returns how many
+ * (up to 4, clipped to 'clip', ordered for cg_rle_rects()), or 0 if the
+ * stroke needs the stroker.
+ */
+static int cg_stroke_device_rects(struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke, struct cg_rect_t * clip, int r[4][4])
+{
+	if(stroke->dash || (m->b != 0.0) || (m->c != 0.0) || (fabs(m->a) != fabs(m->d)))
+		return 0;
+	double h = stroke->width * fabs(m->a) * 0.5;
+	double o[4], in[4];
+	if(h <= 0.0)
+		return 0;
+	if(cg_path_device_box(path, m, o))
+	{
+		/* square corners only with miter joins that aren't cut */
+		if((stroke->join != CG_LINE_JOIN_MITER) || (stroke->miterlimit < 1.41421356237309504880))
+			return 0;
+		if((o[0] == o[2]) || (o[1] == o[3]))
+			return 0;
+		in[0] = o[0] + h;
+		in[1] = o[1] + h;
+		in[2] = o[2] - h;
+		in[3] = o[3] - h;
+		o[0] -= h;
+		o[1] -= h;
+		o[2] += h;
+		o[3] += h;
+		if((in[0] >= in[2]) || (in[1] >= in[3]))
+			return cg_box_clip_int(o, clip, r[0]);
+		double b[4][4] = {
+			{ o[0], o[1], o[2], in[1] },
+			{ o[0], in[1], in[0], in[3] },
+			{ in[2], in[1], o[2], in[3] },
+			{ o[0], in[3], o[2], o[3] },
+		};
+		for(int i = 0; i < 4; i++)
+			if(!cg_box_clip_int(b[i], clip, r[i]))
+				return 0;
+		return 4;
+	}
+	enum cg_path_element_t * e = path->elements.data;
+	if((path->contours != 1) || (path->elements.size != 2) ||
+			(e[0] != CG_PATH_ELEMENT_MOVE_TO) || (e[1] != CG_PATH_ELEMENT_LINE_TO))
+		return 0;
+	if((stroke->cap != CG_LINE_CAP_BUTT) && (stroke->cap != CG_LINE_CAP_SQUARE))
+		return 0;
+	double ext = stroke->cap == CG_LINE_CAP_SQUARE ? h : 0.0;
+	struct cg_point_t p[2];
+	cg_matrix_map_point(m, &path->points.data[0], &p[0]);
+	cg_matrix_map_point(m, &path->points.data[1], &p[1]);
+	if((p[0].y == p[1].y) && (p[0].x != p[1].x))
+	{
+		o[0] = CG_MIN(p[0].x, p[1].x) - ext;
+		o[2] = CG_MAX(p[0].x, p[1].x) + ext;
+		o[1] = p[0].y - h;
+		o[3] = p[0].y + h;
+	}
+	else if((p[0].x == p[1].x) && (p[0].y != p[1].y))
+	{
+		o[1] = CG_MIN(p[0].y, p[1].y) - ext;
+		o[3] = CG_MAX(p[0].y, p[1].y) + ext;
+		o[0] = p[0].x - h;
+		o[2] = p[0].x + h;
+	}
+	else
+		return 0;
+	return cg_box_clip_int(o, clip, r[0]);
+}
+
+/*
+ * Spans for 'count' rectangles. They can't overlap, and the ones sharing
+ * rows must be in x order, so the spans come out sorted.
+ */
+static void cg_rle_rects(struct cg_rle_t * rle, int r[][4], int count)
+{
+	int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+	int n = 0;
+	cg_rle_clear(rle);
+	for(int i = 0; i < count; i++)
+	{
+		if((r[i][0] >= r[i][2]) || (r[i][1] >= r[i][3]))
+			continue;
+		x1 = CG_MIN(x1, r[i][0]);
+		y1 = CG_MIN(y1, r[i][1]);
+		x2 = CG_MAX(x2, r[i][2]);
+		y2 = CG_MAX(y2, r[i][3]);
+		n += r[i][3] - r[i][1];
+	}
+	if(n == 0)
+		return;
+	cg_array_ensure(rle->spans, n);
+	struct cg_span_t * span = rle->spans.data;
+	for(int y = y1; y < y2; y++)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			if((y < r[i][1]) || (y >= r[i][3]) || (r[i][0] >= r[i][2]))
+				continue;
+			span->x = r[i][0];
+			span->len = r[i][2] - r[i][0];
+			span->y = y;
+			span->coverage = 255;
+			span++;
+		}
+	}
+	rle->spans.size = n;
+	rle->x = x1;
+	rle->y = y1;
+	rle->w = x2 - x1;
+	rle->h = y2 - y1;
+}
+
+/*
+ * Solid color, and no clip path: just fill the rows, no spans needed.
+ * Clip boxes are handled by filling the rectangle's intersection with each.
+ */
+static int cg_fill_rect_direct(struct cg_ctx_t * ctx, int r[4])
+{
+	struct cg_state_t * state = ctx->state;
+	if(state->clippath || (state->paint.type != CG_PAINT_TYPE_COLOR))
+		return 0;
+	if((r[0] >= r[2]) || (r[1] >= r[3]))
+		return 1;
+	uint32_t solid = premultiply_color(&state->paint.color, state->opacity);
+	enum cg_operator_t op = state->op;
+	if((CG_ALPHA(solid) == 255) && (op == CG_OPERATOR_SRC_OVER))
+		op = CG_OPERATOR_SRC;
+	cg_comp_solid_function_t func = cg_comp_solid_map[op];
+	struct cg_surface_t * surface = ctx->surface;
+	if(!state->boxes.size)
+	{
+		for(int y = r[1]; y < r[3]; y++)
+			func((uint32_t *)(surface->pixels + y * surface->stride) + r[0], r[2] - r[0], solid, 255);
+		return 1;
+	}
+	struct cg_box_t * b = state->boxes.data;
+	struct cg_box_t * end = b + state->boxes.size;
+	for(; (b < end) && (b->y1 < r[3]); b++)
+	{
+		int x1 = CG_MAX(r[0], b->x1);
+		int x2 = CG_MIN(r[2], b->x2);
+		int y1 = CG_MAX(r[1], b->y1);
+		int y2 = CG_MIN(r[3], b->y2);
+		for(int y = y1; (x1 < x2) && (y < y2); y++)
+			func((uint32_t *)(surface->pixels + y * surface->stride) + x1, x2 - x1, solid, 255);
+	}
+	return 1;
+}
+
+/*
+ * Dashed separators and marching ants: a dashed horizontal or vertical line
+ * with butt caps is one rectangle per dash. If they all fall on pixel
+ * boundaries and the source is a solid color, they are filled directly,
+ * see cg_fill_rect_direct(). The dashes are checked first, then filled, so
+ * it's all or nothing.
+ */
+struct cg_dash_rects_t {
+	struct cg_ctx_t * ctx;
+	struct cg_matrix_t * m;
+	double h;
+	int fill;
+	int ok;
+	struct cg_point_t start;
+};
+
+static void cg_dash_rects_move_to(struct cg_dasher_t * d, double x, double y)
+{
+	struct cg_dash_rects_t * dr = d->user;
+	dr->start.x = x;
+	dr->start.y = y;
+}
+
+static void cg_dash_rects_line_to(struct cg_dasher_t * d, double x, double y)
+{
+	struct cg_dash_rects_t * dr = d->user;
+	struct cg_point_t p[2] = { dr->start, { x, y } };
+	double b[4];
+	int r[4];
+	dr->start = p[1];
+	cg_matrix_map_point(dr->m, &p[0], &p[0]);
+	cg_matrix_map_point(dr->m, &p[1], &p[1]);
+	if((p[0].x == p[1].x) && (p[0].y == p[1].y))
+		return;
+	b[0] = CG_MIN(p[0].x, p[1].x);
+	b[1] = CG_MIN(p[0].y, p[1].y);
+	b[2] = CG_MAX(p[0].x, p[1].x);
+	b[3] = CG_MAX(p[0].y, p[1].y);
+	if(b[1] == b[3])
+	{
+		b[1] -= dr->h;
+		b[3] += dr->h;
+	}
+	else
+	{
+		b[0] -= dr->h;
+		b[2] += dr->h;
+	}
+	if(!cg_box_clip_int(b, &dr->ctx->state->scissor, r))
+		dr->ok = 0;
+	else if(dr->fill)
+		cg_fill_rect_direct(dr->ctx, r);
+}
+
+static int cg_stroke_dash_direct(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke)
+{
+	struct cg_state_t * state = ctx->state;
+	struct cg_dasher_t d;
+	if(state->clippath || (state->paint.type != CG_PAINT_TYPE_COLOR) ||
+			(stroke->cap != CG_LINE_CAP_BUTT) || !cg_dasher_init(&d, stroke->dash))
+		return 0;
+	if((m->b != 0.0) || (m->c != 0.0) || (fabs(m->a) != fabs(m->d)))
+		return 0;
+	enum cg_path_element_t * e = path->elements.data;
+	if((path->contours != 1) || (path->elements.size != 2) ||
+			(e[0] != CG_PATH_ELEMENT_MOVE_TO) || (e[1] != CG_PATH_ELEMENT_LINE_TO))
+		return 0;
+	struct cg_point_t * p = path->points.data;
+	if((p[0].x != p[1].x) == (p[0].y != p[1].y))
+		return 0;
+	struct cg_dash_rects_t dr = {
+		.ctx = ctx, .m = m, .h = stroke->width * fabs(m->a) * 0.5, .ok = 1,
+	};
+	if(dr.h <= 0.0)
+		return 0;
+	d.move_to = cg_dash_rects_move_to;
+	d.line_to = cg_dash_rects_line_to;
+	d.user = &dr;
+	for(dr.fill = 0; dr.fill < 2 && dr.ok; dr.fill++)
+	{
+		cg_dasher_start(&d, p[0].x, p[0].y);
+		cg_dasher_line_to(&d, p[1].x, p[1].y);
 	}
+	return dr.ok;
 }
 
 void cg_fill(struct cg_ctx_t * ctx)
@@ -2540,10 +3928,27 @@ void cg_fill(struct cg_ctx_t * ctx)
 
 void cg_fill_preserve(struct cg_ctx_t * ctx)
 {
+	if(ctx->dlist)
+	{
+		cg_dl_record_draw(ctx, CG_DL_FILL);
+		return;
+	}
 	struct cg_state_t * state = ctx->state;
+	int r[4];
+	if(cg_path_device_rect(ctx->path, &state->matrix, &state->scissor, r))
+	{
+		if(cg_fill_rect_direct(ctx, r))
+			return;
+		cg_rle_rects(ctx->rle, &r, 1);
+		cg_clip_ctx_rle(ctx);
+		cg_blend(ctx, ctx->rle);
+		return;
+	}
+	if(cg_fill_streamed(ctx, ctx->path, &state->matrix, NULL, state->winding))
+		return;
 	cg_rle_clear(ctx->rle);
-	cg_rle_rasterize(ctx, ctx->rle, ctx->path, &state->matrix, &ctx->clip, NULL, state->winding);
-	cg_rle_clip_path(ctx->rle, state->clippath);
+	cg_rle_rasterize(ctx, ctx->rle, ctx->path, &state->matrix, &state->scissor, NULL, state->winding);
+	cg_clip_ctx_rle(ctx);
 	cg_blend(ctx, ctx->rle);
 }
 
@@ -2555,16 +3960,58 @@ void cg_stroke(struct cg_ctx_t * ctx)
 
 void cg_stroke_preserve(struct cg_ctx_t * ctx)
 {
+	if(ctx->dlist)
+	{
+		cg_dl_record_draw(ctx, CG_DL_STROKE);
+		return;
+	}
 	struct cg_state_t * state = ctx->state;
+	int r[4][4];
+	int n = cg_stroke_device_rects(ctx->path, &state->matrix, &state->stroke, &state->scissor, r);
+	if(n)
+	{
+		if(cg_fill_rect_direct(ctx, r[0]))
+		{
+			for(int i = 1; i < n; i++)
+				cg_fill_rect_direct(ctx, r[i]);
+			return;
+		}
+		cg_rle_rects(ctx->rle, r, n);
+		cg_clip_ctx_rle(ctx);
+		cg_blend(ctx, ctx->rle);
+		return;
+	}
+	if(state->stroke.dash && cg_stroke_dash_direct(ctx, ctx->path, &state->matrix, &state->stroke))
+		return;
+	if(cg_fill_streamed(ctx, ctx->path, &state->matrix, &state->stroke, CG_FILL_RULE_NON_ZERO))
+		return;
 	cg_rle_clear(ctx->rle);
-	cg_rle_rasterize(ctx, ctx->rle, ctx->path, &state->matrix, &ctx->clip, &state->stroke, CG_FILL_RULE_NON_ZERO);
-	cg_rle_clip_path(ctx->rle, state->clippath);
+	cg_rle_rasterize(ctx, ctx->rle, ctx->path, &state->matrix, &state->scissor, &state->stroke, CG_FILL_RULE_NON_ZERO);
+	cg_clip_ctx_rle(ctx);
 	cg_blend(ctx, ctx->rle);
 }
 
 void cg_paint(struct cg_ctx_t * ctx)
 {
+	if(ctx->dlist)
+	{
+		cg_dl_record_draw(ctx, CG_DL_PAINT);
+		return;
+	}
 	struct cg_state_t * state = ctx->state;
+	if(state->boxes.size || memcmp(&state->scissor, &ctx->clip, sizeof(ctx->clip)))
+	{
+		struct cg_path_t * path = cg_path_create();
+		cg_path_add_rectangle(path, state->scissor.x, state->scissor.y, state->scissor.w, state->scissor.h);
+		struct cg_matrix_t m;
+		cg_matrix_init_identity(&m);
+		cg_rle_clear(ctx->rle);
+		cg_rle_rasterize(ctx, ctx->rle, path, &m, &state->scissor, NULL, CG_FILL_RULE_NON_ZERO);
+		cg_path_destroy(path);
+		cg_clip_ctx_rle(ctx);
+		cg_blend(ctx, ctx->rle);
+		return;
+	}
 	if((state->clippath == NULL) && (ctx->clippath == NULL))
 	{
 		struct cg_path_t * path = cg_path_create();
@@ -2578,3 +4025,182 @@ void cg_paint(struct cg_ctx_t * ctx)
 	struct cg_rle_t * rle = state->clippath ? state->clippath : ctx->clippath;
 	cg_blend(ctx, rle);
 }
+
+/*
+ * Turns the current path into a retained shape, the current path is
+ * cleared. Draw it with cg_shape_fill()/cg_shape_stroke().
+ */
+struct cg_shape_t * cg_shape_create(struct cg_ctx_t * ctx)
+{
+	struct cg_shape_t * shape = calloc(1, sizeof(struct cg_shape_t));
+	shape->path = ctx->path;
+	ctx->path = cg_path_create();
+	return shape;
+}
+
+void cg_shape_destroy(struct cg_shape_t * shape)
+{
+	if(shape)
+	{
+		for(int i = 0; i < CG_SHAPE_CACHE_SIZE; i++)
+			cg_rle_destroy(shape->cache[i].rle);
+		cg_path_destroy(shape->path);
+		free(shape);
+	}
+}
+
+/*
+ * Copy 'src' into 'rle', offset by dx,dy, and clipped to 'clip' the same
+ * way cg_rle_rasterize() would have clipped it.
+ */
+static void cg_rle_offset_clip(struct cg_rle_t * rle, struct cg_rle_t * src, int dx, int dy, struct cg_rect_t * clip)
+{
+	int cx1 = (int)clip->x;
+	int cy1 = (int)clip->y;
+	int cx2 = (int)(clip->x + clip->w);
+	int cy2 = (int)(clip->y + clip->h);
+	int x1 = INT_MAX, x2 = INT_MIN;
+
+	cg_rle_clear(rle);
+	cg_array_ensure(rle->spans, src->spans.size);
+	struct cg_span_t * out = rle->spans.data;
+	for(int i = 0; i < src->spans.size; i++)
+	{
+		struct cg_span_t * span = &src->spans.data[i];
+		int y = span->y + dy;
+		if((y < cy1) || (y >= cy2))
+			continue;
+		int sx1 = CG_MAX(span->x + dx, cx1);
+		int sx2 = CG_MIN(span->x + dx + span->len, cx2);
+		if(sx1 >= sx2)
+			continue;
+		out->x = sx1;
+		out->len = sx2 - sx1;
+		out->y = y;
+		out->coverage = span->coverage;
+		out++;
+		x1 = CG_MIN(x1, sx1);
+		x2 = CG_MAX(x2, sx2);
+	}
+	rle->spans.size = out - rle->spans.data;
+	if(rle->spans.size)
+	{
+		rle->x = x1;
+		rle->y = rle->spans.data[0].y;
+		rle->w = x2 - x1;
+		rle->h = rle->spans.data[rle->spans.size - 1].y - rle->y + 1;
+	}
+}
+
+/*
+ * The coverage is cached at a whole pixel offset from where the shape is
+ * drawn, so it can be reused at other pixel positions. The 26.6 conversion
+ * truncates toward zero, and so do some of the stroker/rasterizer splits;
+ * so that is only exact if the coordinates are positive both where the
+ * shape is drawn and where it is cached. The cached copy is kept this far
+ * (plus the stroke) from 0,0. A shape drawn closer to 0,0 than that is
+ * cached where it is, without an offset.
+ */
+#define CG_SHAPE_MARGIN	4
+
+/* Integer offset from where 'path' is drawn with 'm' to where it is cached */
+static void cg_shape_offset(struct cg_path_t * path, struct cg_matrix_t * m, double margin, double * ox, double * oy)
+{
+	double x1 = INFINITY, y1 = INFINITY;
+	struct cg_point_t p;
+	for(int i = 0; i < path->points.size; i++)
+	{
+		cg_matrix_map_point(m, &path->points.data[i], &p);
+		x1 = CG_MIN(x1, p.x);
+		y1 = CG_MIN(y1, p.y);
+	}
+	*ox = *oy = 0;
+	if((x1 < margin) || (y1 < margin) || (x1 > (1 << 22)) || (y1 > (1 << 22)))
+		return;
+	*ox = floor(x1 - margin);
+	*oy = floor(y1 - margin);
+}
+
+static void cg_shape_render(struct cg_ctx_t * ctx, struct cg_shape_t * shape, double x, double y, int stroked)
+{
+	struct cg_state_t * state = ctx->state;
+	// recorded as a plain path, at that position
+	if(ctx->dlist)
+	{
+		struct cg_path_t * path = ctx->path;
+		struct cg_matrix_t matrix = state->matrix;
+		ctx->path = shape->path;
+		cg_matrix_translate(&state->matrix, x, y);
+		cg_dl_record_draw(ctx, stroked ? CG_DL_STROKE : CG_DL_FILL);
+		ctx->path = path;
+		state->matrix = matrix;
+		return;
+	}
+	struct cg_matrix_t m = state->matrix;
+	cg_matrix_translate(&m, x, y);
+	// dashes aren't part of the key, so these are not cached
+	if(stroked && state->stroke.dash)
+	{
+		if(cg_fill_streamed(ctx, shape->path, &m, &state->stroke, CG_FILL_RULE_NON_ZERO))
+			return;
+		cg_rle_clear(ctx->rle);
+		cg_rle_rasterize(ctx, ctx->rle, shape->path, &m, &state->scissor, &state->stroke, CG_FILL_RULE_NON_ZERO);
+		cg_clip_ctx_rle(ctx);
+		cg_blend(ctx, ctx->rle);
+		return;
+	}
+	double ix, iy;
+	double margin = CG_SHAPE_MARGIN;
+	if(stroked)
+		margin += state->stroke.width * CG_MAX(state->stroke.miterlimit, 2.0) *
+				cg_matrix_get_scale(&m);
+	cg_shape_offset(shape->path, &m, margin, &ix, &iy);
+	m.tx -= ix;
+	m.ty -= iy;
+
+	struct cg_shape_rle_t * e = NULL;
+	for(int i = 0; i < CG_SHAPE_CACHE_SIZE && !e; i++)
+	{
+		struct cg_shape_rle_t * c = &shape->cache[i];
+		if(!c->rle || (c->stroked != stroked) || memcmp(&c->matrix, &m, sizeof(m)))
+			continue;
+		if(stroked ? ((c->width == state->stroke.width) &&
+					(c->miterlimit == state->stroke.miterlimit) &&
+					(c->cap == state->stroke.cap) &&
+					(c->join == state->stroke.join)) :
+				(c->winding == state->winding))
+			e = c;
+	}
+	if(!e)
+	{
+		e = &shape->cache[shape->next];
+		shape->next = (shape->next + 1) % CG_SHAPE_CACHE_SIZE;
+		if(!e->rle)
+			e->rle = cg_rle_create();
+		cg_rle_clear(e->rle);
+		e->matrix = m;
+		e->stroked = stroked;
+		e->winding = state->winding;
+		e->width = state->stroke.width;
+		e->miterlimit = state->stroke.miterlimit;
+		e->cap = state->stroke.cap;
+		e->join = state->stroke.join;
+		cg_rle_rasterize(ctx, e->rle, shape->path, &m, NULL,
+				stroked ? &state->stroke : NULL,
+				stroked ? CG_FILL_RULE_NON_ZERO : state->winding);
+	}
+	cg_rle_offset_clip(ctx->rle, e->rle, (int)ix, (int)iy, &state->scissor);
+	cg_clip_ctx_rle(ctx);
+	cg_blend(ctx, ctx->rle);
+}
+
+/* Fill 'shape' at x,y (user space), using the current state */
+void cg_shape_fill(struct cg_ctx_t * ctx, struct cg_shape_t * shape, double x, double y)
+{
+	cg_shape_render(ctx, shape, x, y, 0);
+}
+
+void cg_shape_stroke(struct cg_ctx_t * ctx, struct cg_shape_t * shape, double x, double y)
+{
+	cg_shape_render(ctx, shape, x, y, 1);
+}
@@ -127,6 +127,23 @@ struct cg_gradient_t {
 	} stops;
 };
 
+/*
+ * Color lookup table of a gradient, the context keeps the last few, keyed
+ * on the stops and opacity, as the same gradients tend to be set again and
+ * again (with new stops each time) for every frame.
+ */
+#define CG_GRADIENT_LUT_CACHE	4
+
+struct cg_gradient_lut_t {
+	struct {
+		struct cg_gradient_stop_t * data;
+		int size;
+		int capacity;
+	} stops;
+	double opacity;
+	uint32_t colortable[1024];
+};
+
 struct cg_texture_t {
 	enum cg_texture_type_t type;
 	struct cg_surface_t * surface;
@@ -160,6 +177,18 @@ struct cg_rle_t {
 	int h;
 };
 
+/*
+ * Pixel aligned box, x2/y2 are exclusive. A list of these is 'y-x banded'
+ * like pixman regions: sorted by y1 then x1, boxes in the same band have
+ * the same y1/y2, and none overlap.
+ */
+struct cg_box_t {
+	int x1;
+	int y1;
+	int x2;
+	int y2;
+};
+
 struct cg_dash_t {
 	double offset;
 	double * data;
@@ -174,8 +203,39 @@ struct cg_stroke_data_t {
 	struct cg_dash_t * dash;
 };
 
+/*
+ * A retained path, with the coverage of the last few ways it was rendered.
+ * The cache is keyed on the matrix (minus the integer part of the
+ * translation), fill rule, and stroke parameters, so drawing the same
+ * shape at another pixel position just reuses the coverage.
+ */
+#define CG_SHAPE_CACHE_SIZE	4
+
+struct cg_shape_rle_t {
+	struct cg_rle_t * rle;
+	struct cg_matrix_t matrix;
+	int stroked;
+	enum cg_fill_rule_t winding;
+	double width;
+	double miterlimit;
+	enum cg_line_cap_t cap;
+	enum cg_line_join_t join;
+};
+
+struct cg_shape_t {
+	struct cg_path_t * path;
+	struct cg_shape_rle_t cache[CG_SHAPE_CACHE_SIZE];
+	int next;
+};
+
 struct cg_state_t {
 	struct cg_rle_t * clippath;
+	struct cg_rect_t scissor;
+	struct {
+		struct cg_box_t * data;
+		int size;
+		int capacity;
+	} boxes;
 	struct cg_paint_t paint;
 	struct cg_matrix_t matrix;
 	enum cg_fill_rule_t winding;
@@ -185,15 +245,110 @@ struct cg_state_t {
 	struct cg_state_t * next;
 };
 
+/*
+ * Display list: while a list is set with cg_dlist_begin(), cg_fill(),
+ * cg_stroke(), cg_paint(), the clip calls and cg_save()/cg_restore() are
+ * recorded (with the state they need) instead of drawn; cg_dlist_replay()
+ * draws them later, on any context, through its current matrix. Replay
+ * only reads the list, so several threads can replay the same one.
+ *
+ * The buffer is a sequence of commands, each a header followed by 'size'
+ * bytes of payload (a multiple of 8), all in host byte order:
+ *	uint32_t op, uint32_t size
+ * The payloads are made of int32_t and double, see cg_dlist_op_t. The first
+ * command is always CG_DL_HEADER, the format only changes with a new
+ * CG_DLIST_VERSION. Texture sources refer to surfaces held by the list,
+ * so only that part isn't meaningful outside of the process. Replay stops
+ * at the first command whose size doesn't hold what its op reads.
+ */
+#define CG_DLIST_MAGIC		0x4c444743	/* 'CGDL' */
+#define CG_DLIST_VERSION	1
+
+enum cg_dlist_op_t {
+	CG_DL_HEADER		= 0,	/* magic, version */
+	CG_DL_SAVE			= 1,
+	CG_DL_RESTORE		= 2,
+	/* op, winding, cap, join, ndash, (pad); matrix[6], opacity,
+	 * line width, miter limit, dash offset, dashes[ndash] */
+	CG_DL_STATE			= 3,
+	CG_DL_COLOR			= 4,	/* r, g, b, a */
+	/* type, spread, nstops, (pad); matrix[6], values[6], opacity,
+	 * stops[nstops] as offset, r, g, b, a */
+	CG_DL_GRADIENT		= 5,
+	CG_DL_TEXTURE		= 6,	/* type, surface index; matrix[6], opacity */
+	/* nelements, npoints, contours, (pad); start x, y; elements[nelements]
+	 * (padded to 8 bytes); points[npoints] as x, y */
+	CG_DL_PATH			= 7,
+	CG_DL_FILL			= 8,
+	CG_DL_STROKE		= 9,
+	CG_DL_PAINT			= 10,
+	CG_DL_CLIP			= 11,
+	CG_DL_RESET_CLIP	= 12,
+	CG_DL_SCISSOR		= 13,	/* x, y, w, h */
+	CG_DL_CLIP_BOXES	= 14,	/* count, (pad); boxes[count] as x1, y1, x2, y2 */
+};
+
+struct cg_dlist_t {
+	struct {
+		unsigned char * data;
+		int size;
+		int capacity;
+	} cmds;
+	struct {
+		struct cg_surface_t ** data;
+		int size;
+		int capacity;
+	} surfaces;
+	/* last STATE, source and PATH commands, to not repeat them */
+	int last_state;
+	int last_source;
+	int last_path;
+};
+
+/*
+ * Per context bump allocator for the short lived bits, ie the states (and
+ * their dashes) pushed by cg_save(). cg_arena_reset() rewinds it, once per
+ * frame; if anything had to be malloc()ed as it didn't fit, the arena is
+ * grown then, to fit that frame. 'stats' is for the current frame, 'last'
+ * for the previous one.
+ */
+#ifndef CG_ARENA_SIZE
+#define CG_ARENA_SIZE	(8 * 1024)
+#endif
+
+struct cg_arena_stats_t {
+	size_t size;
+	size_t peak;
+	size_t overflow;
+	unsigned int allocs;
+	unsigned int mallocs;
+};
+
+struct cg_arena_t {
+	char * data;
+	size_t used;
+	int live;
+	struct cg_arena_stats_t stats;
+	struct cg_arena_stats_t last;
+};
+
 struct cg_ctx_t {
 	struct cg_surface_t * surface;
 	struct cg_state_t * state;
 	struct cg_path_t * path;
 	struct cg_rle_t * rle;
+	struct cg_rle_t * spare;
 	struct cg_rle_t * clippath;
 	struct cg_rect_t clip;
 	void * outline_data;
 	size_t outline_size;
+	XCG_FT_Raster_Pool raster_pool;
+	XCG_FT_Stroker stroker;
+	struct cg_arena_t arena;
+	struct cg_gradient_lut_t * luts[CG_GRADIENT_LUT_CACHE];
+	int lut_next;
+	struct cg_dlist_t * dlist;
+	int raster_threads;	/* > 1 to rasterize large paths in that many bands/threads */
 };
 
 #ifndef CG_MIN
@@ -301,11 +456,27 @@ void cg_close_path(struct cg_ctx_t * ctx);
 void cg_reset_clip(struct cg_ctx_t * ctx);
 void cg_clip(struct cg_ctx_t * ctx);
 void cg_clip_preserve(struct cg_ctx_t * ctx);
+void cg_scissor(struct cg_ctx_t * ctx, double x, double y, double w, double h);
+void cg_clip_boxes(struct cg_ctx_t * ctx, const struct cg_box_t * boxes, int count);
 void cg_fill(struct cg_ctx_t * ctx);
 void cg_fill_preserve(struct cg_ctx_t * ctx);
 void cg_stroke(struct cg_ctx_t * ctx);
 void cg_stroke_preserve(struct cg_ctx_t * ctx);
 void cg_paint(struct cg_ctx_t * ctx);
+void cg_arena_reset(struct cg_ctx_t * ctx);
+
+struct cg_shape_t * cg_shape_create(struct cg_ctx_t * ctx);
+void cg_shape_destroy(struct cg_shape_t * shape);
+void cg_shape_fill(struct cg_ctx_t * ctx, struct cg_shape_t * shape, double x, double y);
+void cg_shape_stroke(struct cg_ctx_t * ctx, struct cg_shape_t * shape, double x, double y);
+
+struct cg_dlist_t * cg_dlist_create(void);
+void cg_dlist_destroy(struct cg_dlist_t * dl);
+void cg_dlist_clear(struct cg_dlist_t * dl);
+void cg_dlist_begin(struct cg_ctx_t * ctx, struct cg_dlist_t * dl);
+void cg_dlist_end(struct cg_ctx_t * ctx);
+void cg_dlist_replay(struct cg_ctx_t * ctx, struct cg_dlist_t * dl);
+const void * cg_dlist_get_data(struct cg_dlist_t * dl, size_t * size);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,220 @@
+/*
+ * cg_comp.h
+ *
+ * Copyright (C) 2024 Michel Pollet <buserror@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Vector versions of the cg_comp_* span functions. This is a 'template',
+ * included by cg.c once per vector width, with these defined:
+ * CG_V			the vector type (vector of uint32_t)
+ * CG_VN		the number of uint32_t in CG_V
+ * CG_V_ATTR	function attribute(s), ie the target() for the width
+ * CG_V_NAME(_n) makes the function name for this width
+ *
+ * The math is exactly the same as the scalar versions (the CG_BYTE_MUL
+ * macro works on vectors too), the results are bit for bit the same.
+ * The remaining pixels at the end of a span are done one by one.
+ */
+
+#define CG_V_LOAD(_v, _p)	memcpy(&(_v), (_p), sizeof(CG_V))
+#define CG_V_STORE(_p, _v)	memcpy((_p), &(_v), sizeof(CG_V))
+
+static CG_V_ATTR void CG_V_NAME(cg_comp_solid_source)(uint32_t * dst, int len, uint32_t color, uint32_t alpha)
+{
+	if(alpha == 255)
+	{
+		cg_memfill32(dst, color, len);
+		return;
+	}
+	uint32_t ialpha = 255 - alpha;
+	color = CG_BYTE_MUL(color, alpha);
+	int i = 0;
+	for(; i + CG_VN <= len; i += CG_VN)
+	{
+		CG_V d;
+		CG_V_LOAD(d, dst + i);
+		d = color + CG_BYTE_MUL(d, ialpha);
+		CG_V_STORE(dst + i, d);
+	}
+	for(; i < len; i++)
+		dst[i] = color + CG_BYTE_MUL(dst[i], ialpha);
+}
+
+static CG_V_ATTR void CG_V_NAME(cg_comp_solid_source_over)(uint32_t * dst, int len, uint32_t color, uint32_t alpha)
+{
+	if((alpha & CG_ALPHA(color)) == 255)
+	{
+		cg_memfill32(dst, color, len);
+		return;
+	}
+	if(alpha != 255)
+		color = CG_BYTE_MUL(color, alpha);
+	uint32_t ialpha = 255 - CG_ALPHA(color);
+	int i = 0;
+	for(; i + CG_VN <= len; i += CG_VN)
+	{
+		CG_V d;
+		CG_V_LOAD(d, dst + i);
+		d = color + CG_BYTE_MUL(d, ialpha);
+		CG_V_STORE(dst + i, d);
+	}
+	for(; i < len; i++)
+		dst[i] = color + CG_BYTE_MUL(dst[i], ialpha);
+}
+
+/* destination_in and destination_out only differ by the alpha they use */
+static CG_V_ATTR void CG_V_NAME(cg_comp_solid_destination)(uint32_t * dst, int len, uint32_t a)
+{
+	int i = 0;
+	for(; i + CG_VN <= len; i += CG_VN)
+	{
+		CG_V d;
+		CG_V_LOAD(d, dst + i);
+		d = CG_BYTE_MUL(d, a);
+		CG_V_STORE(dst + i, d);
+	}
+	for(; i < len; i++)
+		dst[i] = CG_BYTE_MUL(dst[i], a);
+}
+
+static CG_V_ATTR void CG_V_NAME(cg_comp_solid_destination_in)(uint32_t * dst, int len, uint32_t color, uint32_t alpha)
+{
+	uint32_t a = CG_ALPHA(color);
+	if(alpha != 255)
+		a = CG_BYTE_MUL(a, alpha) + 255 - alpha;
+	CG_V_NAME(cg_comp_solid_destination)(dst, len, a);
+}
+
+static CG_V_ATTR void CG_V_NAME(cg_comp_solid_destination_out)(uint32_t * dst, int len, uint32_t color, uint32_t alpha)
+{
+	uint32_t a = CG_ALPHA(~color);
+	if(alpha != 255)
+		a = CG_BYTE_MUL(a, alpha) + 255 - alpha;
+	CG_V_NAME(cg_comp_solid_destination)(dst, len, a);
+}
+
+static CG_V_ATTR void CG_V_NAME(cg_comp_source)(uint32_t * dst, int len, uint32_t * src, uint32_t alpha)
+{
+	if(alpha == 255)
+	{
+		memcpy(dst, src, (size_t)(len) * sizeof(uint32_t));
+		return;
+	}
+	uint32_t ialpha = 255 - alpha;
+	int i = 0;
+	for(; i + CG_VN <= len; i += CG_VN)
+	{
+		// this is interpolate_pixel()
+		CG_V x, y, t;
+		CG_V_LOAD(x, src + i);
+		CG_V_LOAD(y, dst + i);
+		t = (x & 0xff00ff) * alpha + (y & 0xff00ff) * ialpha;
+		t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+		t &= 0xff00ff;
+		x = ((x >> 8) & 0xff00ff) * alpha + ((y >> 8) & 0xff00ff) * ialpha;
+		x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+		x &= 0xff00ff00;
+		x |= t;
+		CG_V_STORE(dst + i, x);
+	}
+	for(; i < len; i++)
+		dst[i] = interpolate_pixel(src[i], alpha, dst[i], ialpha);
+}
+
+static CG_V_ATTR void CG_V_NAME(cg_comp_source_over)(uint32_t * dst, int len, uint32_t * src, uint32_t alpha)
+{
+	int i = 0;
+	if(alpha == 255)
+	{
+		for(; i + CG_VN <= len; i += CG_VN)
+		{
+			CG_V s, d;
+			CG_V_LOAD(s, src + i);
+			CG_V_LOAD(d, dst + i);
+			/* opaque pixels end up as 's' as CG_BYTE_MUL(d, 0) is zero,
+			 * but transparent ones have to be masked, as
+			 * CG_BYTE_MUL(d, 255) isn't quite 'd' */
+			CG_V zero = (CG_V)(s == 0);
+			CG_V r = s + CG_BYTE_MUL(d, CG_ALPHA(~s));
+			r = (r & ~zero) | (d & zero);
+			CG_V_STORE(dst + i, r);
+		}
+		for(; i < len; i++)
+		{
+			uint32_t s = src[i];
+			if(s >= 0xff000000)
+				dst[i] = s;
+			else if(s != 0)
+				dst[i] = s + CG_BYTE_MUL(dst[i], CG_ALPHA(~s));
+		}
+	}
+	else
+	{
+		for(; i + CG_VN <= len; i += CG_VN)
+		{
+			CG_V s, d;
+			CG_V_LOAD(s, src + i);
+			CG_V_LOAD(d, dst + i);
+			s = CG_BYTE_MUL(s, alpha);
+			d = s + CG_BYTE_MUL(d, CG_ALPHA(~s));
+			CG_V_STORE(dst + i, d);
+		}
+		for(; i < len; i++)
+		{
+			uint32_t s = CG_BYTE_MUL(src[i], alpha);
+			dst[i] = s + CG_BYTE_MUL(dst[i], CG_ALPHA(~s));
+		}
+	}
+}
+
+static CG_V_ATTR void CG_V_NAME(cg_comp_destination_in)(uint32_t * dst, int len, uint32_t * src, uint32_t alpha)
+{
+	uint32_t cia = 255 - alpha;
+	int i = 0;
+	for(; i + CG_VN <= len; i += CG_VN)
+	{
+		CG_V s, d;
+		CG_V_LOAD(s, src + i);
+		CG_V_LOAD(d, dst + i);
+		CG_V a = CG_ALPHA(s);
+		if(alpha != 255)
+			a = CG_BYTE_MUL(a, alpha) + cia;
+		d = CG_BYTE_MUL(d, a);
+		CG_V_STORE(dst + i, d);
+	}
+	for(; i < len; i++)
+	{
+		uint32_t a = CG_ALPHA(src[i]);
+		if(alpha != 255)
+			a = CG_BYTE_MUL(a, alpha) + cia;
+		dst[i] = CG_BYTE_MUL(dst[i], a);
+	}
+}
+
+static CG_V_ATTR void CG_V_NAME(cg_comp_destination_out)(uint32_t * dst, int len, uint32_t * src, uint32_t alpha)
+{
+	uint32_t cia = 255 - alpha;
+	int i = 0;
+	for(; i + CG_VN <= len; i += CG_VN)
+	{
+		CG_V s, d;
+		CG_V_LOAD(s, src + i);
+		CG_V_LOAD(d, dst + i);
+		CG_V a = CG_ALPHA(~s);
+		if(alpha != 255)
+			a = CG_BYTE_MUL(a, alpha) + cia;
+		d = CG_BYTE_MUL(d, a);
+		CG_V_STORE(dst + i, d);
+	}
+	for(; i < len; i++)
+	{
+		uint32_t a = CG_ALPHA(~src[i]);
+		if(alpha != 255)
+			a = CG_BYTE_MUL(a, alpha) + cia;
+		dst[i] = CG_BYTE_MUL(dst[i], a);
+	}
+}
+
+#undef CG_V_LOAD
+#undef CG_V_STORE
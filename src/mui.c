@@ -11,6 +11,9 @@
 #include <ctype.h>
 
 #include "mui_priv.h"
+#include "cg.h"
+
+IMPLEMENT_C_ARRAY(mui_shape_array);
 
 void
 mui_init(
@@ -24,6 +27,8 @@ mui_init(
 	ui->color.highlight = MUI_COLOR(0xd6fcc0ff);
 	ui->timer.map = 0;
 	ui->carret_timer = 0xff;
+	ui->redraw_policy.max_rects = 16;
+	ui->redraw_policy.waste = 25;
 	TAILQ_INIT(&ui->windows);
 	TAILQ_INIT(&ui->fonts);
 	mui_font_init(ui);
@@ -36,6 +41,7 @@ void
 mui_dispose(
 		mui_t *ui)
 {
+	mui_draw_tiles_dispose(ui);
 	pixman_region32_fini(&ui->inval);
 	pixman_region32_fini(&ui->redraw);
 	mui_utf8_free(&ui->clipboard);
@@ -46,29 +52,225 @@ mui_dispose(
 	}
 }
 
+/*
+ * Windows that were dragged since the last draw have the pixels that were
+ * visible moved to their new position on screen, so only the part that
+ * was hidden (or offscreen) needs redrawing. This has to be done before
+ * anything else is drawn, as it relies on the screen being as it was
+ * left by the previous mui_draw().
+ */
+static void
+_mui_draw_moved_windows(
+		mui_t *ui,
+		mui_drawable_t *dr,
+		uint16_t all)
+{
+	mui_window_t * win;
+	TAILQ_FOREACH(win, &ui->windows, self) {
+		c2_pt_t d = win->moved;
+		if (!d.x && !d.y)
+			continue;
+		win->moved = (c2_pt_t){};
+		if (all || ui->flags.backing_store || win->flags.hidden)
+			continue;
+		// other windows were moved or restacked since, the pixels on
+		// screen can't be trusted; redraw it all instead
+		if (win->moved_gen != ui->window_stack_gen) {
+			pixman_region32_union_rect(&win->inval, &win->inval,
+					win->frame.l, win->frame.t,
+					c2_rect_width(&win->frame), c2_rect_height(&win->frame));
+			continue;
+		}
+		// whatever was covering the window then, is still covering it now
+		pixman_region32_t above = {};
+		for (mui_window_t * w = TAILQ_NEXT(win, self); w;
+						w = TAILQ_NEXT(w, self)) {
+			if (w->flags.hidden)
+				continue;
+			pixman_region32_union_rect(&above, &above,
+				w->frame.l, w->frame.t,
+				c2_rect_width(&w->frame), c2_rect_height(&w->frame));
+		}
+		c2_rect_t old = win->frame;
+		c2_rect_offset(&old, -d.x, -d.y);
+		pixman_region32_t src = {}, dst = {};
+		pixman_region32_init_rect(&src, old.l, old.t,
+				c2_rect_width(&old), c2_rect_height(&old));
+		pixman_region32_subtract(&src, &src, &above);
+		pixman_region32_translate(&src, d.x, d.y);
+		pixman_region32_init_rect(&dst, win->frame.l, win->frame.t,
+				c2_rect_width(&win->frame), c2_rect_height(&win->frame));
+		pixman_region32_subtract(&dst, &dst, &above);
+		pixman_region32_intersect(&dst, &dst, &src);
+		pixman_region32_intersect_rect(&dst, &dst,
+				0, 0, dr->pix.size.x, dr->pix.size.y);
+		pixman_region32_intersect_rect(&dst, &dst,
+				d.x, d.y, dr->pix.size.x, dr->pix.size.y);
+		mui_drawable_move_pixels(dr, &dst, d.x, d.y);
+		// the rest of the window needs redrawing
+		pixman_region32_fini(&src);
+		pixman_region32_init_rect(&src, win->frame.l, win->frame.t,
+				c2_rect_width(&win->frame), c2_rect_height(&win->frame));
+		pixman_region32_subtract(&src, &src, &dst);
+		pixman_region32_union(&win->inval, &win->inval, &src);
+		pixman_region32_fini(&src);
+		pixman_region32_fini(&dst);
+		pixman_region32_fini(&above);
+	}
+}
+
+/*
+ * Calculate the visible region of each windows, front to back. Hidden
+ * windows, or windows that are completely covered by others are flagged
+ * as 'occluded', and aren't drawn at all. 'done' returns the union of
+ * all the visible windows.
+ */
+static void
+_mui_draw_visible(
+		mui_t *ui,
+		mui_drawable_t *dr,
+		pixman_region32_t *done)
+{
+	mui_window_t * win;
+	TAILQ_FOREACH_REVERSE(win, &ui->windows, windows, self) {
+		pixman_region32_fini(&win->visible);
+		pixman_region32_init_rect(&win->visible,
+				win->frame.l, win->frame.t,
+				c2_rect_width(&win->frame), c2_rect_height(&win->frame));
+		pixman_region32_intersect_rect(&win->visible, &win->visible,
+				0, 0, dr->pix.size.x, dr->pix.size.y);
+		pixman_region32_subtract(&win->visible, &win->visible, done);
+		win->flags.occluded = win->flags.hidden ||
+				!pixman_region32_not_empty(&win->visible);
+		if (win->flags.occluded)
+			continue;
+		pixman_region32_union_rect(done, done,
+			win->frame.l, win->frame.t,
+			c2_rect_width(&win->frame), c2_rect_height(&win->frame));
+	}
+}
+
+static uint64_t
+_mui_region_area(
+		pixman_region32_t *rgn)
+{
+	int cnt = 0;
+	c2_rect_t * r = (c2_rect_t*)pixman_region32_rectangles(rgn, &cnt);
+	uint64_t area = 0;
+	for (int i = 0; i < cnt; i++)
+		area += (uint64_t)c2_rect_width(&r[i]) * c2_rect_height(&r[i]);
+	return area;
+}
+
+/*
+ * The budget is only checked once something was drawn, so we are
+ * guaranteed to make progress even with a silly small budget.
+ */
+static bool
+_mui_draw_over_budget(
+		uint64_t pixels,
+		mui_time_t start,
+		uint32_t max_pixels,
+		mui_time_t max_time)
+{
+	if (!pixels)
+		return false;
+	if (max_pixels && pixels >= max_pixels)
+		return true;
+	if (max_time && mui_get_time() - start >= max_time)
+		return true;
+	return false;
+}
+
+/*
+ * Only the part of the desk that is dirty, and not under a window is
+ * redrawn, the boxes are passed as is to pixman, no need for a clip.
+ */
+static void
+_mui_draw_desk(
+		mui_t *ui,
+		mui_drawable_t *dr,
+		pixman_region32_t *done)
+{
+	if (ui->desk.transparent)
+		return;
+	pixman_region32_t sect = {};
+	c2_rect_t desk = C2_RECT(0, 0, dr->pix.size.x, dr->pix.size.y);
+	pixman_region32_inverse(&sect, done, (pixman_box32_t*)&desk);
+	pixman_region32_intersect(&sect, &sect, &ui->inval);
+	int cnt = 0;
+	pixman_box32_t * r = pixman_region32_rectangles(&sect, &cnt);
+	if (!cnt)
+		goto out;
+	mui_drawable_set_clip(dr, NULL);
+	if (ui->desk.pattern) {
+		// the pattern isn't ours, tile it from our own image of its pixels
+		pixman_image_t * src = mui_pixmap_make_pixman(&ui->desk.pattern->pix);
+		pixman_image_set_repeat(src, PIXMAN_REPEAT_NORMAL);
+		for (int i = 0; i < cnt; i++)
+			pixman_image_composite32(PIXMAN_OP_SRC,
+					src, NULL, mui_drawable_get_pixman(dr),
+					r[i].x1, r[i].y1, 0, 0, r[i].x1, r[i].y1,
+					r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
+		pixman_image_unref(src);
+	} else
+		pixman_image_fill_boxes(
+				ui->color.clear.value ? PIXMAN_OP_SRC : PIXMAN_OP_CLEAR,
+				mui_drawable_get_pixman(dr),
+				&PIXMAN_COLOR(ui->color.clear), cnt, r);
+out:
+	pixman_region32_fini(&sect);
+}
+
 void
 mui_draw(
 		mui_t *ui,
 		mui_drawable_t *dr,
 		uint16_t all)
+{
+	mui_draw_budget(ui, dr, all, 0, 0);
+}
+
+bool
+mui_draw_budget(
+		mui_t *ui,
+		mui_drawable_t *dr,
+		uint16_t all,
+		uint32_t max_pixels,
+		mui_time_t max_time)
 {
 	if (!(all || pixman_region32_not_empty(&ui->inval)))
-		return;
+		return false;
+	bool budget = max_pixels || max_time;
+	mui_time_t start = max_time ? mui_get_time() : 0;
+	uint64_t pixels = 0;
+	// what was left for the next call, if we ran out of budget
+	pixman_region32_t left = {};
 	if (all) {
 	//	printf("%s: all\n", __func__);
 		c2_rect_t whole = C2_RECT(0, 0, dr->pix.size.x, dr->pix.size.y);
 		pixman_region32_reset(&ui->inval, (pixman_box32_t*)&whole);
 	}
 	mui_drawable_set_clip(dr, NULL);
+	_mui_draw_moved_windows(ui, dr, all);
 
 	/*
-	 * Windows are drawn top to bottom, their area/rectangle is added to the
-	 * done region, the done region (any windows that are overlaping others)
-	 * is substracted to any other windows update region before drawing...
-	 * once all windows are done, the 'done' region (sum of all the windows),
-	 * is substracted from the 'desk' area and erased.
+	 * The visible region of each windows is calculated first, top to
+	 * bottom, their area/rectangle is added to the done region, the done
+	 * region (any windows that are overlaping others) is substracted to any
+	 * other windows visible region. Once all windows are done, the 'done'
+	 * region (sum of all the windows), is substracted from the 'desk'
+	 * area and erased.
+	 * Occluded windows are skipped, and keep their inval region for when
+	 * they get uncovered. Same for windows that didn't fit in the budget,
+	 * but their area is also left in ui->inval for the next call.
+	 * In backing store mode, the windows are only redrawn in their own
+	 * buffer when they are dirty, and the screen is composited from these.
+	 * Otherwise, the clipped inval regions are calculated first, and the
+	 * windows are drawn after.
 	 */
 	pixman_region32_t done = {};
+	_mui_draw_visible(ui, dr, &done);
 
 	mui_window_t * win;
 	TAILQ_FOREACH_REVERSE(win, &ui->windows, windows, self) {
@@ -77,42 +279,190 @@ mui_draw(
 					c2_rect_width(&win->frame), c2_rect_height(&win->frame));
 
 		mui_drawable_set_clip(dr, NULL);
-		if (!all)
-			mui_drawable_clip_push_region(dr, &win->inval);
-		else
-			mui_drawable_clip_push(dr, &win->frame);
-		pixman_region32_clear(&win->inval);
-
-		mui_drawable_clip_substract_region(dr, &done);
-		mui_window_draw(win, dr);
+		if (ui->flags.backing_store) {
+			if (win->flags.occluded)
+				continue;
+			if (budget &&
+					_mui_draw_over_budget(pixels, start, max_pixels, max_time)) {
+				pixman_region32_t rest = {};
+				pixman_region32_intersect(&rest, &win->visible, &ui->inval);
+				pixman_region32_union(&left, &left, &rest);
+				pixman_region32_fini(&rest);
+				continue;
+			}
+			pixels += win->backing ?
+						_mui_region_area(&win->inval) :
+						(uint64_t)c2_rect_width(&win->frame) *
+								c2_rect_height(&win->frame);
+			/*
+			 * Refresh whatever is dirty in the window's own backing store,
+			 * then composite the dirty part of the screen from it.
+			 */
+			mui_window_draw_backing(win);
+			mui_drawable_clip_push_region(dr, &ui->inval);
+			mui_drawable_clip_push_region(dr, &win->visible);
+			pixman_image_composite32(PIXMAN_OP_SRC,
+					mui_drawable_get_pixman(win->backing), NULL,
+					mui_drawable_get_pixman(dr),
+					0, 0, 0, 0, win->frame.l, win->frame.t,
+					c2_rect_width(&win->frame), c2_rect_height(&win->frame));
+		} else {
+			/* Pixels can only be scrolled from/to the visible part of the
+			 * window, the rest is added to the window inval region */
+			mui_drawable_clip_push_region(dr, &win->visible);
+			mui_window_draw_scroll(win, dr);
+			if (all)
+				pixman_region32_reset(&win->inval,
+						(pixman_box32_t*)&win->frame);
+			if (win->flags.occluded)
+				continue;
+			// what is left is the visible part that needs drawing
+			pixman_region32_intersect(&win->inval, &win->inval, &win->visible);
+			// might have been carried from a previous draw, when occluded
+			pixman_region32_union(&ui->inval, &ui->inval, &win->inval);
+		}
 	//	printf("  %s : %s\n", win->title, c2_rect_as_str(&win->frame));
-		pixman_region32_union_rect(&done, &done,
-			win->frame.l, win->frame.t,
-			c2_rect_width(&win->frame), c2_rect_height(&win->frame));
 	}
 
+	/*
+	 * Now the window's inval regions don't overlap, so they can be drawn
+	 * in any order, or in parallel if mui_draw_tiles() wants to. With a
+	 * budget, they are drawn front to back until it runs out.
+	 */
+	if (!ui->flags.backing_store) {
+		if (budget || !mui_draw_tiles(ui, dr)) {
+			TAILQ_FOREACH_REVERSE(win, &ui->windows, windows, self) {
+				if (win->flags.occluded ||
+						!pixman_region32_not_empty(&win->inval))
+					continue;
+				if (budget && _mui_draw_over_budget(
+								pixels, start, max_pixels, max_time)) {
+					pixman_region32_union(&left, &left, &win->inval);
+					continue;
+				}
+				pixels += _mui_region_area(&win->inval);
+				mui_drawable_set_clip(dr, NULL);
+				mui_drawable_clip_push_region(dr, &win->inval);
+				mui_window_draw(win, dr);
+				pixman_region32_clear(&win->inval);
+			}
+		} else {
+			TAILQ_FOREACH(win, &ui->windows, self)
+				if (!win->flags.occluded)
+					pixman_region32_clear(&win->inval);
+		}
+	}
+	_mui_draw_desk(ui, dr, &done);
 	mui_drawable_set_clip(dr, NULL);
-	pixman_region32_t sect = {};
-	c2_rect_t desk = C2_RECT(0, 0, dr->pix.size.x, dr->pix.size.y);
-	pixman_region32_inverse(&sect, &done, (pixman_box32_t*)&desk);
-
-	mui_drawable_clip_push_region(dr, &sect);
-
-	pixman_image_fill_boxes(
-			ui->color.clear.value ? PIXMAN_OP_SRC : PIXMAN_OP_CLEAR,
-			mui_drawable_get_pixman(dr),
-			&PIXMAN_COLOR(ui->color.clear), 1, (pixman_box32_t*)&desk);
-	pixman_region32_fini(&sect);
 	pixman_region32_fini(&done);
 
+	pixman_region32_subtract(&ui->inval, &ui->inval, &left);
 	pixman_region32_union(&ui->redraw, &ui->redraw, &ui->inval);
-	pixman_region32_clear(&ui->inval);
+	pixman_region32_copy(&ui->inval, &left);
+	pixman_region32_fini(&left);
+	// end of the frame for the cg arenas, see cg_arena_reset()
+	if (dr->cg)
+		cg_arena_reset(dr->cg);
+	TAILQ_FOREACH(win, &ui->windows, self) {
+		if (win->backing && win->backing->cg)
+			cg_arena_reset(win->backing->cg);
+	}
 	if (ui->draw_debug) {
 		// save a png of the current screen
 		ui->draw_debug = 0;
 		printf("%s: saving debug.png\n", __func__);
 	//	mui_drawable_save_to_png(dr, "debug.png");
 	}
+	return pixman_region32_not_empty(&ui->inval);
+}
+
+void
+mui_redraw_coalesce(
+		mui_t *ui,
+		c2_rect_array_p out)
+{
+	c2_rect_array_clear(out);
+	int cnt = 0;
+	c2_rect_t * r = (c2_rect_t*)pixman_region32_rectangles(
+							&ui->redraw, &cnt);
+	if (!cnt)
+		return;
+	c2_rect_t box = *(c2_rect_t*)pixman_region32_extents(&ui->redraw);
+	if (cnt > 1 && ui->redraw_policy.waste) {
+		uint64_t area = 0;
+		for (int i = 0; i < cnt; i++)
+			area += (uint64_t)c2_rect_width(&r[i]) * c2_rect_height(&r[i]);
+		uint64_t total = (uint64_t)c2_rect_width(&box) * c2_rect_height(&box);
+		if ((total - area) * 100 <= total * ui->redraw_policy.waste) {
+			c2_rect_array_add(out, box);
+			return;
+		}
+	}
+	uint max = ui->redraw_policy.max_rects;
+	if (!max || (uint)cnt <= max) {
+		c2_rect_array_append(out, r, cnt);
+		return;
+	}
+	// the cheap pass first, merges the obvious ones
+	c2_rect_array_t in = {};
+	c2_rect_array_append(&in, r, cnt);
+	c2_rect_array_simplify(&in, out);
+	c2_rect_array_free(&in);
+	/*
+	 * Then merge the pair that adds the least area to the union, until
+	 * we have few enough. There's not many of them, so it's just a brute
+	 * force search.
+	 */
+	while (out->count > max) {
+		uint bi = 0, bj = 1;
+		int64_t best = INT64_MAX;
+		for (uint i = 0; i < out->count; i++) {
+			c2_rect_p a = &out->e[i];
+			int64_t sa = (int64_t)c2_rect_width(a) * c2_rect_height(a);
+			for (uint j = i + 1; j < out->count; j++) {
+				c2_rect_p b = &out->e[j];
+				c2_rect_t u = *a;
+				c2_rect_union(&u, b);
+				int64_t waste = (int64_t)c2_rect_width(&u) * c2_rect_height(&u) -
+						sa - (int64_t)c2_rect_width(b) * c2_rect_height(b);
+				if (waste < best) {
+					best = waste;
+					bi = i;
+					bj = j;
+				}
+			}
+		}
+		c2_rect_union(&out->e[bi], &out->e[bj]);
+		c2_rect_array_delete(out, bj, 1);
+	}
+}
+
+uint
+mui_redraw_get(
+		mui_t *ui,
+		mui_drawable_t *dr,
+		c2_rect_array_p out)
+{
+	mui_redraw_coalesce(ui, out);
+	if (!dr)
+		return out->count;
+	for (int i = out->count - 1; i >= 0; i--) {
+		c2_rect_p r = &out->e[i];
+		if (r->l < 0)	r->l = 0;
+		if (r->t < 0)	r->t = 0;
+		if (r->r > dr->pix.size.x)	r->r = dr->pix.size.x;
+		if (r->b > dr->pix.size.y)	r->b = dr->pix.size.y;
+		if (c2_rect_isempty(r))
+			c2_rect_array_delete(out, i, 1);
+	}
+	return out->count;
+}
+
+void
+mui_redraw_ack(
+		mui_t *ui)
+{
+	pixman_region32_clear(&ui->redraw);
 }
 
 bool
@@ -323,6 +323,13 @@ struct mui_listbox_elem_t;
 /*
  * Window DEFinition -- Handle all related to a window, from drawing to
  * event handling.
+ *
+ * Drawing and threads: with mui_t.draw_threads > 1, MUI_WDEF_DRAW and
+ * MUI_CDEF_DRAW can be called for the same window and controls from several
+ * threads at once, each with its own drawable (and clip). They must then
+ * only read the window and control state, and only draw into the drawable
+ * they are given; anything else they share (caches etc) needs its own lock.
+ * All the other messages are only sent from the thread calling mui_run().
  */
 enum {
 	MUI_WDEF_INIT = 0,	// param is NULL
@@ -467,6 +474,19 @@ DECLARE_C_ARRAY(mui_region_t, mui_clip_stack, 2);
  * 	...
  * 	mui_drawable_clip_pop(dr);
  */
+/*
+ * Retained cg round rectangle, for button frames etc. The coverage is
+ * kept in the cg_shape_t, so same sized controls don't rasterize again.
+ */
+typedef struct mui_shape_t {
+	c2_pt_t 					size;
+	uint16_t					radius;
+	struct cg_shape_t *			shape;
+} mui_shape_t;
+
+DECLARE_C_ARRAY(mui_shape_t, mui_shape_array, 4);
+#define MUI_SHAPE_CACHE_MAX		32
+
 typedef struct mui_drawable_t {
 	mui_pixmap_t				pix;	// *has* to be first in struct
 	void * 						_pix_hash; // used to detect if pix has changed
@@ -486,6 +506,9 @@ typedef struct mui_drawable_t {
 	// (default) position in destination when drawing (optional)
 	c2_pt_t 					origin;
 	mui_clip_stack_t			clip;
+	// button shapes drawn on this drawable, see mui_cdef_buttons.c. Each
+	// mui_draw_tiles() thread keeps its own drawable, so they don't share them
+	mui_shape_array_t			shapes;
 } mui_drawable_t;
 
 // Use IMPLEMENT_C_ARRAY(mui_drawable_array); if you need this
@@ -556,6 +579,29 @@ mui_drawable_clip_pop(
 pixman_region32_t *
 mui_drawable_clip_get(
 		mui_drawable_t * dr);
+/*
+ * Every pixel in 'rgn' gets the pixel that was at x-dx,y-dy. Overlapping
+ * source and destination are fine. 'rgn' is the *destination* region.
+ */
+void
+mui_drawable_move_pixels(
+		mui_drawable_t * dr,
+		pixman_region32_t * rgn,
+		int dx,
+		int dy );
+/*
+ * Move the pixels inside 'r' by dx,dy, a bit like the old ScrollRect().
+ * Only pixels that are inside 'r' AND the current clip, both before and
+ * after moving, are copied. If 'update' is not NULL it receives the part
+ * of 'r' that could not be filled by moving pixels, and needs redrawing.
+ */
+void
+mui_drawable_scroll(
+		mui_drawable_t * dr,
+		c2_rect_p r,
+		int dx,
+		int dy,
+		pixman_region32_t * update );
 
 
 /*
@@ -788,6 +834,7 @@ typedef struct mui_window_t {
 	struct {
 		uint						hidden: 1,
 									disposed : 1,
+									occluded : 1,	// set by mui_draw()
 									layer : 4,
 									style: 4,	// specific to the WDEF
 									hit_part : 8;
@@ -804,6 +851,22 @@ typedef struct mui_window_t {
 	mui_control_ref_t 			control_clicked;
 	mui_control_ref_t	 		control_focus;
 	mui_region_t				inval;
+	// part of the frame that is on screen, and not covered by other
+	// windows. Recalculated at each mui_draw()
+	mui_region_t				visible;
+	// pending mui_window_scroll(), in content coordinates, applied by mui_draw()
+	struct {
+		c2_rect_t					rect;
+		c2_pt_t						delta;
+	}							scroll;
+	// how much the window was dragged since the last mui_draw()
+	c2_pt_t						moved;
+	// mui_t window_stack_gen after that drag; if the stack changed since,
+	// mui_draw() redraws the window instead of moving its pixels
+	uint32_t					moved_gen;
+	// window sized (not screen sized!) cache of the window pixels, only used
+	// when mui_t flags.backing_store is set. See mui_draw()
+	mui_drawable_t *			backing;
 } mui_window_t;
 
 /*
@@ -840,6 +903,18 @@ void
 mui_window_inval(
 		mui_window_t *	win,
 		c2_rect_t * 	r);
+/*
+ * Scroll the pixels of 'r' (in window coordinates) by dx,dy. This is lazy,
+ * the pixels are moved at the next mui_draw() and only the exposed part
+ * of 'r' is redrawn. If that's not possible (the area is already dirty, or
+ * another area is already being scrolled), it just invalidates 'r'.
+ */
+void
+mui_window_scroll(
+		mui_window_t *	win,
+		c2_rect_t * 	r,
+		int 			dx,
+		int 			dy);
 // return true if the window is the frontmost window (in that window's layer)
 bool
 mui_window_isfront(
@@ -1005,6 +1080,7 @@ typedef struct mui_control_t {
 	uint32_t					style;
 	struct {
 		uint		 			hidden : 1,
+								dirty : 1,	// set by mui_control_inval()
 								hit_part : 8;
 	}							flags;
 	uint32_t					value;
@@ -1373,11 +1449,47 @@ typedef struct mui_t {
 	mui_time_t 					last_click_stamp[MUI_EVENT_BUTTON_MAX];
 	int 						draw_debug;
 	int							quit_request;
+	struct {
+		// windows render in their own backing store, mui_draw() just
+		// composites them on the screen. Costs one window sized buffer
+		// per window, but moving/uncovering windows is a simple blit.
+		uint						backing_store : 1;
+	}							flags;
+	/* The desk is what is behind the windows. It is filled with
+	 * color.clear, or tiled with 'pattern' if set (it is not owned by mui).
+	 * When 'transparent' is set, the desk pixels are never touched, for
+	 * when the UI is composited over something else (emulated screen). */
+	struct {
+		mui_drawable_t *			pattern;
+		uint						transparent : 1;
+	}							desk;
+	// if > 1, large redraws are split in that many bands, each drawn by
+	// it's own thread. Not used with backing_store. See mui_draw_tiles.c
+	uint8_t						draw_threads;
+	// the threads for draw_threads, kept from one frame to the next
+	struct mui_draw_tiles_t *	draw_tiles;
+	// incremented when windows are added, removed, reordered or dragged,
+	// so mui_draw() knows when a window's 'moved' pixels are stale
+	uint32_t					window_stack_gen;
 	// this is the sum of all the window's dirty regions, inc moved windows etc
 	mui_region_t 				inval;
 	// once the pixels have been refreshed, 'inval' is copied to 'redraw'
 	// to push the pixels to the screen.
 	mui_region_t 				redraw;
+	/* How mui_redraw_coalesce() turns 'redraw' into a list of rectangles.
+	 * 'waste' is the % of the bounding box that can be wasted (not dirty)
+	 * and still use just the bounding box. 'max_rects' is the maximum
+	 * number of rectangles, the ones that waste the least area are merged
+	 * until there are no more than that. Zero means disabled for both. */
+	struct {
+		uint16_t					max_rects;
+		uint8_t						waste;
+	}							redraw_policy;
+	// control draw statistics, from mui_window_draw(). Never reset by mui,
+	// 'dirty' are controls that were drawn because they asked to be.
+	struct {
+		uint32_t					drawn, culled, dirty;
+	}							control_stats;
 
 	TAILQ_HEAD(, mui_font_t) 	fonts;
 	TAILQ_HEAD(windows, mui_window_t) 	windows;
@@ -1401,9 +1513,47 @@ mui_draw(
 		mui_t *			ui,
 		mui_drawable_t *dr,
 		uint16_t 		all);
+/*
+ * Incremental version of mui_draw(). Windows are drawn front to back,
+ * and once 'max_pixels' have been redrawn, or 'max_time' (in mui_time_t
+ * units) has elapsed, the remaining windows are left in ui->inval for
+ * the next call. Zero means 'no limit' for either. At least one window
+ * is always drawn. Returns true if there is more drawing to do.
+ * Note that budgeted draws don't use mui_draw_tiles().
+ */
+bool
+mui_draw_budget(
+		mui_t *			ui,
+		mui_drawable_t *dr,
+		uint16_t 		all,
+		uint32_t 		max_pixels,
+		mui_time_t 		max_time);
 void
 mui_run(
 		mui_t *			ui);
+/*
+ * Returns (in 'out') the rectangles in ui->redraw, coalesced according
+ * to ui->redraw_policy. The rectangles *can* overlap. This doesn't clear
+ * the redraw region.
+ */
+void
+mui_redraw_coalesce(
+		mui_t *			ui,
+		c2_rect_array_p out);
+/*
+ * For texture uploaders etc: returns the number of rectangles that were
+ * damaged since the last mui_redraw_ack(), in 'out'. These are coalesced
+ * as above, and clipped to 'dr' (the drawable passed to mui_draw()).
+ */
+uint
+mui_redraw_get(
+		mui_t *			ui,
+		mui_drawable_t *dr,
+		c2_rect_array_p out);
+// Clear the damaged rectangles, once they have been pushed to the screen
+void
+mui_redraw_ack(
+		mui_t *			ui);
 
 /* If you want this notification, attach an action function to the
  * menubar */
@@ -12,6 +12,8 @@
 #include "mui.h"
 #include "cg.h"
 
+IMPLEMENT_C_ARRAY(mui_shape_array);
+
 enum {
 	MUI_CONTROL_BUTTON				= FCC('b','u','t','n'),
 
@@ -19,6 +21,39 @@ enum {
 
 extern const mui_control_color_t mui_control_color[MUI_CONTROL_STATE_COUNT];
 
+/*
+ * The round rectangles of the buttons are retained cg shapes, so a dialog
+ * full of same sized buttons only rasterizes them once. The cache is kept
+ * in the drawable, so the mui_draw_tiles() threads each have their own,
+ * and don't need a lock.
+ */
+static struct cg_shape_t *
+_mui_button_shape(
+		mui_drawable_t *dr,
+		struct cg_ctx_t * cg,
+		c2_rect_t *		r,
+		uint16_t 		radius)
+{
+	c2_pt_t size = C2_PT(c2_rect_width(r), c2_rect_height(r));
+	for (uint i = 0; i < dr->shapes.count; i++) {
+		mui_shape_t * s = &dr->shapes.e[i];
+		if (s->size.x == size.x && s->size.y == size.y &&
+				s->radius == radius)
+			return s->shape;
+	}
+	if (dr->shapes.count >= MUI_SHAPE_CACHE_MAX) {
+		cg_shape_destroy(dr->shapes.e[0].shape);
+		mui_shape_array_delete(&dr->shapes, 0, 1);
+	}
+	cg_new_path(cg);
+	cg_round_rectangle(cg, 0, 0, size.x, size.y, radius, radius);
+	mui_shape_t s = {
+		.size = size, .radius = radius, .shape = cg_shape_create(cg),
+	};
+	mui_shape_array_add(&dr->shapes, s);
+	return s.shape;
+}
+
 #define BUTTON_INSET 4
 void
 mui_button_draw(
@@ -34,10 +69,7 @@ mui_button_draw(
 	cg_set_source_color(cg, &CG_COLOR(mui_control_color[c->state].frame));
 	if (c->style == MUI_BUTTON_STYLE_DEFAULT) {
 		cg_set_line_width(cg, 3);
-		cg_round_rectangle(cg, f.l, f.t,
-						c2_rect_width(&f), c2_rect_height(&f),
-						10, 10);
-		cg_stroke(cg);
+		cg_shape_stroke(cg, _mui_button_shape(dr, cg, &f, 10), f.l, f.t);
 		c2_rect_inset(&f, BUTTON_INSET, BUTTON_INSET);
 	}
 	mui_font_t * main = mui_font_find(win->ui, "main");
@@ -54,14 +86,13 @@ mui_button_draw(
 	c2_rect_t inner = f;
 	c2_rect_inset(&inner, 1, 1);
 	cg_set_line_width(cg, 2);
-	cg_round_rectangle(cg, inner.l, inner.t,
-					c2_rect_width(&inner), c2_rect_height(&inner), 6, 6);
+	struct cg_shape_t * shape = _mui_button_shape(dr, cg, &inner, 6);
 	cg_set_source_color(cg, &CG_COLOR(mui_control_color[c->state].fill));
-	cg_fill_preserve(cg);
+	cg_shape_fill(cg, shape, inner.l, inner.t);
 //	cg_rectangle(cg, title.l, title.t,
 //					c2_rect_width(&title), c2_rect_height(&title));
 	cg_set_source_color(cg, &CG_COLOR(mui_control_color[c->state].frame));
-	cg_stroke(cg);
+	cg_shape_stroke(cg, shape, inner.l, inner.t);
 	// offset for leading space
 	mui_font_text_draw(main, dr,
 			C2_PT(title.l - m.x0, title.t), c->title, strlen(c->title),
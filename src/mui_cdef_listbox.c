@@ -222,6 +222,24 @@ mui_listbox_key(
 	return false;
 }
 
+/*
+ * Change the scroll position, moving the pixels of the rows already drawn,
+ * so only the newly exposed rows are redrawn.
+ */
+static void
+mui_listbox_scroll_to(
+		mui_listbox_control_t *lb,
+		int32_t 		scroll)
+{
+	if (scroll == lb->scroll)
+		return;
+	mui_control_t * c = &lb->control;
+	c2_rect_t f = c->frame;
+	c2_rect_inset(&f, 1, 1);	// same as the clip in mui_listbox_draw()
+	mui_window_scroll(c->win, &f, 0, lb->scroll - scroll);
+	lb->scroll = scroll;
+}
+
 static bool
 mui_listbox_cdef_event(
 		struct mui_control_t * 	c,
@@ -268,16 +286,16 @@ mui_listbox_cdef_event(
 		}	break;
 		case MUI_EVENT_WHEEL: {
 		//	printf("%s wheel delta %d\n", __func__, ev->wheel.delta);
-			lb->scroll += ev->wheel.delta * 20;
-			if (lb->scroll < 0)
-				lb->scroll = 0;
-			if (lb->scroll >
+			int32_t scroll = lb->scroll + ev->wheel.delta * 20;
+			if (scroll < 0)
+				scroll = 0;
+			if (scroll >
 					(int32_t)((lb->elems.count * lb->elem_height) -
 							c2_rect_height(&c->frame)))
-				lb->scroll = (lb->elems.count * lb->elem_height) -
+				scroll = (lb->elems.count * lb->elem_height) -
 									c2_rect_height(&c->frame);
+			mui_listbox_scroll_to(lb, scroll);
 			mui_control_set_value(lb->scrollbar, lb->scroll);
-			mui_control_inval(c);
 			return true;
 		}	break;
 		default:
@@ -330,9 +348,8 @@ mui_listbox_sbar_action(
 		void * 			param)
 {
 	mui_listbox_control_t *lb = (mui_listbox_control_t *)cb_param;
-	lb->scroll = mui_control_get_value(lb->scrollbar);
+	mui_listbox_scroll_to(lb, mui_control_get_value(lb->scrollbar));
 //	printf("%s scroll %d\n", __func__, lb->scroll);
-	mui_control_inval(&lb->control);
 	return 0;
 }
 
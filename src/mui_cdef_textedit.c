@@ -390,14 +390,13 @@ _mui_textedit_refresh_sel(
 
 /* this makes sure the text is always visible in the frame */
 static void
-_mui_textedit_clamp_text_frame(
+_mui_textedit_clamp_text_rect(
 		mui_textedit_control_t *	te)
 {
 	c2_rect_t f = te->control.frame;
 	c2_rect_offset(&f, -f.l, -f.t);
 	if (te->flags & MUI_CONTROL_TEXTBOX_FRAME)
 		c2_rect_inset(&f, te->margin.x, te->margin.y);
-	c2_rect_t old = te->text_content;
 	te->text_content.r = te->text_content.l + te->measure.margin_right;
 	te->text_content.b = te->text_content.t + te->measure.height;
 	D(printf("  %s %s / %3dx%3d\n", __func__,
@@ -413,6 +412,14 @@ _mui_textedit_clamp_text_frame(
 				c2_rect_width(&f) - te->text_content.r, 0);
 	if (te->text_content.l > f.l)
 		c2_rect_offset(&te->text_content, f.l - te->text_content.l, 0);
+}
+
+static void
+_mui_textedit_clamp_text_frame(
+		mui_textedit_control_t *	te)
+{
+	c2_rect_t old = te->text_content;
+	_mui_textedit_clamp_text_rect(te);
 	if (c2_rect_equal(&te->text_content, &old))
 		return;
 	D(printf("   clamped TE from %s to %s\n", c2_rect_as_str(&old),
@@ -420,6 +427,40 @@ _mui_textedit_clamp_text_frame(
 	mui_control_inval(&te->control);
 }
 
+/*
+ * Scroll the text by dx,dy (clamped). The pixels of the text area are
+ * moved, so only the exposed strip and the margins (with the scroll
+ * position indicators) are redrawn.
+ */
+static void
+_mui_textedit_scroll(
+		mui_textedit_control_t *	te,
+		int 						dx,
+		int 						dy)
+{
+	c2_rect_t old = te->text_content;
+	c2_rect_offset(&te->text_content, dx, dy);
+	_mui_textedit_clamp_text_rect(te);
+	dx = te->text_content.l - old.l;
+	dy = te->text_content.t - old.t;
+	if (!dx && !dy)
+		return;
+	mui_control_t * c = &te->control;
+	c2_rect_t f = c->frame;
+	if (!(te->flags & MUI_CONTROL_TEXTBOX_FRAME)) {
+		mui_window_scroll(c->win, &f, dx, dy);
+		return;
+	}
+	c2_rect_inset(&f, te->margin.x, te->margin.y);
+	mui_window_scroll(c->win, &f, dx, dy);
+	c2_rect_t m = c->frame;
+	m.t = f.b;
+	mui_window_inval(c->win, &m);
+	m = c->frame;
+	m.l = f.r;
+	mui_window_inval(c->win, &m);
+}
+
 /* This scrolls the view following the carret, used when typing.
  * This doesn't check for out of bounds, but the clamping should
  * have made sure the text is always visible. */
@@ -806,27 +847,19 @@ mui_textedit_mouse(
 			if (!c2_rect_contains_pt(&f, &ev->mouse.where)) {
 				if (te->flags & MUI_CONTROL_TEXTEDIT_VERTICAL) {
 					if (ev->mouse.where.y > f.b) {
-						te->text_content.tl.y -= ev->mouse.where.y - f.b;
+						_mui_textedit_scroll(te, 0, -(ev->mouse.where.y - f.b));
 						D(printf("scroll down %3d\n", te->text_content.tl.y);)
-						_mui_textedit_clamp_text_frame(te);
-						mui_control_inval(c);
 					} else if (ev->mouse.where.y < f.t) {
-						te->text_content.tl.y += f.t - ev->mouse.where.y;
+						_mui_textedit_scroll(te, 0, f.t - ev->mouse.where.y);
 						D(printf("scroll up   %3d\n", te->text_content.tl.y);)
-						_mui_textedit_clamp_text_frame(te);
-						mui_control_inval(c);
 					}
 				} else {
 					if (ev->mouse.where.x > f.r) {
-						te->text_content.tl.x -= ev->mouse.where.x - f.r;
+						_mui_textedit_scroll(te, -(ev->mouse.where.x - f.r), 0);
 						D(printf("scroll right %3d\n", te->text_content.tl.x);)
-						_mui_textedit_clamp_text_frame(te);
-						mui_control_inval(c);
 					} else if (ev->mouse.where.x < f.l) {
-						te->text_content.tl.x += f.l - ev->mouse.where.x;
+						_mui_textedit_scroll(te, f.l - ev->mouse.where.x, 0);
 						D(printf("scroll left  %3d\n", te->text_content.tl.x);)
-						_mui_textedit_clamp_text_frame(te);
-						mui_control_inval(c);
 					}
 				}
 			}
@@ -855,13 +888,9 @@ mui_textedit_mouse(
 		}	break;
 		case MUI_EVENT_WHEEL: {
 			if (te->flags & MUI_CONTROL_TEXTEDIT_VERTICAL) {
-				te->text_content.tl.y -= ev->wheel.delta * 10;
-				_mui_textedit_clamp_text_frame(te);
-				mui_control_inval(c);
+				_mui_textedit_scroll(te, 0, -ev->wheel.delta * 10);
 			} else {
-				te->text_content.tl.x -= ev->wheel.delta * 10;
-				_mui_textedit_clamp_text_frame(te);
-				mui_control_inval(c);
+				_mui_textedit_scroll(te, -ev->wheel.delta * 10, 0);
 			}
 			res = true;
 		}	break;
@@ -249,6 +249,7 @@ mui_control_inval(
 {
 	if (!c)
 		return;
+	c->flags.dirty = 1;
 	mui_window_inval(c->win, &c->frame);
 }
 
@@ -0,0 +1,222 @@
+/*
+ * mui_draw_tiles.c
+ *
+ * Copyright (C) 2023 Michel Pollet <buserror@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Optional multithreaded drawing for mui_draw(). The dirty area is split
+ * in horizontal bands, and each band is drawn by it's own thread, with it's
+ * own drawable (sharing the screen pixels), clip stack and cg context.
+ * As the window inval regions do not overlap once mui_draw() has subtracted
+ * the windows on top, and the bands don't overlap either, the pixels end up
+ * exactly the same as drawing them in one go.
+ *
+ * The threads and their drawables are kept in the ui from one frame to the
+ * next, so the cg contexts and button shape caches stay warm, and there is
+ * no thread creation per frame; they just wait for the next one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "mui_priv.h"
+
+// not worth waking threads up for less than that many pixels
+#define MUI_DRAW_TILES_MIN_AREA		(256 * 256)
+#define MUI_DRAW_TILES_MAX			16
+
+typedef struct mui_draw_tile_t {
+	struct mui_draw_tiles_t *	set;
+	mui_drawable_t				dr;
+	c2_rect_t					rect;
+	pthread_t					thread;
+	bool						started;
+} mui_draw_tile_t;
+
+/*
+ * Tile 0 is drawn by the caller of mui_draw_tiles(), the others by their
+ * thread. Threads wait on 'wake' for 'frame' to change, and the last one
+ * done with it signals 'done'.
+ */
+typedef struct mui_draw_tiles_t {
+	mui_t *						ui;
+	pthread_mutex_t				lock;
+	pthread_cond_t				wake, done;
+	uint32_t					frame;
+	int							pending;
+	bool						quit;
+	int							count;
+	mui_draw_tile_t				tile[MUI_DRAW_TILES_MAX];
+} mui_draw_tiles_t;
+
+static void
+_mui_draw_tile(
+		mui_draw_tile_t * t)
+{
+	mui_window_t * win;
+	TAILQ_FOREACH_REVERSE(win, &t->set->ui->windows, windows, self) {
+		if (win->flags.occluded)
+			continue;
+		if (pixman_region32_contains_rectangle(&win->inval,
+				(pixman_box32_t*)&t->rect) == PIXMAN_REGION_OUT)
+			continue;
+		mui_drawable_set_clip(&t->dr, NULL);
+		mui_drawable_clip_push(&t->dr, &t->rect);
+		mui_drawable_clip_push_region(&t->dr, &win->inval);
+		mui_window_draw(win, &t->dr);
+	}
+}
+
+static void *
+_mui_draw_tile_thread(
+		void * param)
+{
+	mui_draw_tile_t * t = param;
+	mui_draw_tiles_t * s = t->set;
+	// threads are all started before the first frame
+	uint32_t frame = 0;
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (!s->quit && s->frame == frame)
+			pthread_cond_wait(&s->wake, &s->lock);
+		if (s->quit)
+			break;
+		frame = s->frame;
+		pthread_mutex_unlock(&s->lock);
+		if (!c2_rect_isempty(&t->rect))
+			_mui_draw_tile(t);
+		pthread_mutex_lock(&s->lock);
+		if (--s->pending == 0)
+			pthread_cond_signal(&s->done);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+static mui_draw_tiles_t *
+_mui_draw_tiles_new(
+		mui_t *ui,
+		int count)
+{
+	mui_draw_tiles_t * s = calloc(1, sizeof(*s));
+	s->ui = ui;
+	s->count = count;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->wake, NULL);
+	pthread_cond_init(&s->done, NULL);
+	for (int i = 0; i < count; i++) {
+		mui_draw_tile_t * t = &s->tile[i];
+		t->set = s;
+		// the first band is done by the calling thread
+		if (i > 0)
+			t->started = pthread_create(&t->thread, NULL,
+								_mui_draw_tile_thread, t) == 0;
+	}
+	return s;
+}
+
+void
+mui_draw_tiles_dispose(
+		mui_t *ui)
+{
+	mui_draw_tiles_t * s = ui->draw_tiles;
+	if (!s)
+		return;
+	pthread_mutex_lock(&s->lock);
+	s->quit = true;
+	pthread_cond_broadcast(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	for (int i = 0; i < s->count; i++) {
+		mui_draw_tile_t * t = &s->tile[i];
+		if (t->started)
+			pthread_join(t->thread, NULL);
+		mui_drawable_dispose(&t->dr);
+	}
+	pthread_cond_destroy(&s->done);
+	pthread_cond_destroy(&s->wake);
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+	ui->draw_tiles = NULL;
+}
+
+bool
+mui_draw_tiles(
+		mui_t *ui,
+		mui_drawable_t *dr)
+{
+	int count = ui->draw_threads;
+	if (count > MUI_DRAW_TILES_MAX)
+		count = MUI_DRAW_TILES_MAX;
+	if (count < 2)
+		return false;
+	// split the bounding box of what needs drawing
+	c2_rect_t r = {};
+	mui_window_t * win;
+	TAILQ_FOREACH(win, &ui->windows, self) {
+		if (!win->flags.occluded && pixman_region32_not_empty(&win->inval))
+			c2_rect_union(&r,
+					(c2_rect_t*)pixman_region32_extents(&win->inval));
+	}
+	if (r.l < 0) r.l = 0;
+	if (r.t < 0) r.t = 0;
+	if (r.r > dr->pix.size.x) r.r = dr->pix.size.x;
+	if (r.b > dr->pix.size.y) r.b = dr->pix.size.y;
+	if (c2_rect_isempty(&r) ||
+			c2_rect_width(&r) * c2_rect_height(&r) < MUI_DRAW_TILES_MIN_AREA)
+		return false;
+	int band = (c2_rect_height(&r) + count - 1) / count;
+	if (band < 1)
+		band = 1;
+
+	// the threads only read the windows and controls, see mui.h
+	TAILQ_FOREACH(win, &ui->windows, self) {
+		if (!win->flags.occluded)
+			mui_window_draw_prepare(win);
+	}
+	mui_draw_tiles_t * s = ui->draw_tiles;
+	if (s && s->count != count)
+		mui_draw_tiles_dispose(ui);
+	if (!ui->draw_tiles)
+		ui->draw_tiles = _mui_draw_tiles_new(ui, count);
+	s = ui->draw_tiles;
+	int pending = 0;
+	for (int i = 0; i < count; i++) {
+		mui_draw_tile_t * t = &s->tile[i];
+		t->rect = r;
+		t->rect.t = r.t + (i * band);
+		t->rect.b = t->rect.t + band;
+		if (t->rect.b > r.b)
+			t->rect.b = r.b;
+		// the drawables are kept, unless the screen changed
+		if (t->dr.pix.pixels != dr->pix.pixels ||
+				t->dr.pix.size.x != dr->pix.size.x ||
+				t->dr.pix.size.y != dr->pix.size.y ||
+				t->dr.pix.bpp != dr->pix.bpp ||
+				t->dr.pix.row_bytes != dr->pix.row_bytes) {
+			mui_drawable_dispose(&t->dr);
+			mui_drawable_init(&t->dr, dr->pix.size, dr->pix.bpp,
+					dr->pix.pixels, dr->pix.row_bytes);
+		}
+		pending += t->started;
+	}
+	pthread_mutex_lock(&s->lock);
+	s->pending = pending;
+	s->frame++;
+	pthread_cond_broadcast(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	for (int i = 0; i < count; i++) {
+		mui_draw_tile_t * t = &s->tile[i];
+		// also picks up the bands that failed to start a thread
+		if (!t->started && !c2_rect_isempty(&t->rect))
+			_mui_draw_tile(t);
+	}
+	pthread_mutex_lock(&s->lock);
+	while (s->pending)
+		pthread_cond_wait(&s->done, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+	return true;
+}
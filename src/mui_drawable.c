@@ -8,6 +8,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #include <pixman.h>
 #include "mui.h"
@@ -15,6 +17,7 @@
 
 
 IMPLEMENT_C_ARRAY(mui_clip_stack);
+IMPLEMENT_C_ARRAY(mui_shape_array);
 
 // create a new mui_draware of size w x h, bpp depth.
 // optionally allocate the pixels if pixels is NULL
@@ -71,6 +74,9 @@ mui_drawable_clear(
 	for (uint i = 0; i < dr->clip.count; i++)
 		pixman_region32_fini(&dr->clip.e[i]);
 	mui_clip_stack_clear(&dr->clip);
+	for (uint i = 0; i < dr->shapes.count; i++)
+		cg_shape_destroy(dr->shapes.e[i].shape);
+	mui_shape_array_clear(&dr->shapes);
 	if (dr->pix.pixels && dr->dispose_pixels)
 		free(dr->pix.pixels);
 	static const mui_pixmap_t zero = {};
@@ -87,10 +93,16 @@ mui_drawable_dispose(
 		return;
 	mui_drawable_clear(dr);
 	mui_clip_stack_free(&dr->clip);
+	mui_shape_array_free(&dr->shapes);
 	if (dr->dispose_drawable)
 		free(dr);
 }
 
+/*
+ * A clip that is a single rectangle (the vast majority) is just a scissor
+ * for cg, nothing to rasterize. Otherwise the region's boxes are handed to
+ * cg as they are, and spans are clipped against them.
+ */
 static struct cg_ctx_t *
 _cg_updated_clip(
 		mui_drawable_t * dr)
@@ -101,14 +113,17 @@ _cg_updated_clip(
 	cg_reset_clip(dr->cg);
 	if (!dr->clip.count)
 		return dr->cg;
+	pixman_region32_t * rgn = &dr->clip.e[dr->clip.count - 1];
 	int cnt = 0;
-	pixman_box32_t *r = pixman_region32_rectangles(
-			&dr->clip.e[dr->clip.count-1], &cnt);
-	for (int i = 0; i < cnt; i++) {
-		cg_rectangle(dr->cg, r[i].x1, r[i].y1,
-				r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
+	pixman_box32_t *r = pixman_region32_rectangles(rgn, &cnt);
+	if (cnt <= 1) {
+		// empty region gives an empty extent, which clips everything
+		pixman_box32_t *e = pixman_region32_extents(rgn);
+		cg_scissor(dr->cg, e->x1, e->y1, e->x2 - e->x1, e->y2 - e->y1);
+		return dr->cg;
 	}
-	cg_clip(dr->cg);
+	// pixman_box32_t is the same as cg_box_t, and is y-x banded already
+	cg_clip_boxes(dr->cg, (struct cg_box_t *)r, cnt);
 	return dr->cg;
 }
 
@@ -171,12 +186,16 @@ mui_pixmap_make_pixman(
 	return res;
 }
 
-union pixman_image *
-mui_drawable_get_pixman(
+/*
+ * Source drawables (icons etc) can be shared by the mui_draw_tiles() threads,
+ * the lazy creation of their pixman image needs to be serialized.
+ */
+static pthread_mutex_t	mui_drawable_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static union pixman_image *
+_mui_drawable_get_pixman(
 		mui_drawable_t * dr)
 {
-	if (!dr)
-		return NULL;
 	void * _hash = dr->pix.pixels + dr->pix.size.y * dr->pix.row_bytes;
 	if (dr->_pix_hash != _hash) {
 		dr->_pix_hash = _hash;
@@ -193,6 +212,18 @@ mui_drawable_get_pixman(
 	return _pixman_updated_clip(dr);
 }
 
+union pixman_image *
+mui_drawable_get_pixman(
+		mui_drawable_t * dr)
+{
+	if (!dr)
+		return NULL;
+	pthread_mutex_lock(&mui_drawable_mutex);
+	union pixman_image * res = _mui_drawable_get_pixman(dr);
+	pthread_mutex_unlock(&mui_drawable_mutex);
+	return res;
+}
+
 pixman_region32_t *
 mui_drawable_clip_get(
 		mui_drawable_t * dr)
@@ -319,3 +350,94 @@ mui_drawable_clip_pop(
 	dr->pixman_clip_dirty = 1;
 	dr->cg_clip_dirty = 1;
 }
+
+void
+mui_drawable_move_pixels(
+		mui_drawable_t * dr,
+		pixman_region32_t * rgn,
+		int dx,
+		int dy )
+{
+	if (!dr || !rgn || !dr->pix.pixels || (!dx && !dy))
+		return;
+	// both source and destination have to be in the pixmap
+	pixman_region32_t dst = {};
+	pixman_region32_intersect_rect(&dst, rgn,
+			0, 0, dr->pix.size.x, dr->pix.size.y);
+	pixman_region32_intersect_rect(&dst, &dst,
+			dx, dy, dr->pix.size.x, dr->pix.size.y);
+	/*
+	 * Regions are sorted in bands, top to bottom, left to right. Walk
+	 * them backward if we're moving down, or right, so we never read
+	 * pixels that have already been overwritten. memmove takes care of
+	 * the overlap within a row.
+	 */
+	int cnt = 0;
+	pixman_box32_t *b = pixman_region32_rectangles(&dst, &cnt);
+	const int bpp = dr->pix.bpp / 8;
+	const int rb = dr->pix.row_bytes;
+	int bi = dy > 0 ? cnt - 1 : 0;
+	while (bi >= 0 && bi < cnt) {
+		// find the extent [bs, be) of the band we're in
+		int bs = bi, be = bi + 1;
+		if (dy > 0) {
+			while (bs > 0 && b[bs-1].y1 == b[bi].y1)
+				bs--;
+			bi = bs - 1;
+		} else {
+			while (be < cnt && b[be].y1 == b[bi].y1)
+				be++;
+			bi = be;
+		}
+		int y1 = b[bs].y1, y2 = b[bs].y2;
+		for (int yi = 0; yi < y2 - y1; yi++) {
+			int y = dy > 0 ? y2 - 1 - yi : y1 + yi;
+			uint8_t * d = (uint8_t*)dr->pix.pixels + (y * rb);
+			uint8_t * s = (uint8_t*)dr->pix.pixels + ((y - dy) * rb);
+			for (int i = 0; i < be - bs; i++) {
+				pixman_box32_t * e = &b[dx > 0 ? be - 1 - i : bs + i];
+				memmove(d + (e->x1 * bpp), s + ((e->x1 - dx) * bpp),
+						(e->x2 - e->x1) * bpp);
+			}
+		}
+	}
+	pixman_region32_fini(&dst);
+}
+
+void
+mui_drawable_scroll(
+		mui_drawable_t * dr,
+		c2_rect_p r,
+		int dx,
+		int dy,
+		pixman_region32_t * update )
+{
+	if (!dr || !r)
+		return;
+	/*
+	 * The destination is where both the source and the destination
+	 * are inside 'r' and the clip.
+	 */
+	pixman_region32_t dst = {}, src = {};
+	pixman_region32_init_rect(&src, r->l, r->t,
+			c2_rect_width(r), c2_rect_height(r));
+	if (dr->clip.count)
+		pixman_region32_intersect(&src, &src, &dr->clip.e[dr->clip.count-1]);
+	pixman_region32_copy(&dst, &src);
+	pixman_region32_translate(&src, dx, dy);
+	pixman_region32_intersect(&dst, &dst, &src);
+	pixman_region32_intersect_rect(&dst, &dst,
+			0, 0, dr->pix.size.x, dr->pix.size.y);
+	pixman_region32_intersect_rect(&dst, &dst,
+			dx, dy, dr->pix.size.x, dr->pix.size.y);
+	pixman_region32_fini(&src);
+
+	mui_drawable_move_pixels(dr, &dst, dx, dy);
+	if (update) {
+		pixman_region32_fini(update);
+		pixman_region32_init_rect(update, r->l, r->t,
+				c2_rect_width(r), c2_rect_height(r));
+		pixman_region32_subtract(update, update, &dst);
+	}
+	pixman_region32_fini(&dst);
+}
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #define STB_TTC_IMPLEMENTATION
@@ -28,6 +29,13 @@ INCBIN(geneva_font, "fonts/Geneva.ttf");
 
 #include "mui.h"
 
+/*
+ * The glyph cache is shared, and grows (reallocs) as glyphs are rendered,
+ * so when mui_draw_tiles() uses threads, the text functions have to be
+ * serialized.
+ */
+static pthread_mutex_t	mui_font_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 // "Narrow style" reduces the advance by this factor
 // Not the 'space' characters are reduced even more (twice that)
 #define MUI_NARROW_ADVANCE_FACTOR	0.92
@@ -113,7 +121,9 @@ mui_font_text_measure(
 {
 	struct stb_ttc_info * ttc = &font->ttc;
 	float scale = stbtt_ScaleForPixelHeight(&ttc->font, font->size);
+	pthread_mutex_lock(&mui_font_mutex);
 	int w = stb_ttc_MeasureText(ttc, scale, text, m);
+	pthread_mutex_unlock(&mui_font_mutex);
 	return w;
 }
 
@@ -143,6 +153,7 @@ mui_font_text_draw(
 	pixman_image_t * fill = pixman_image_create_solid_fill(&pc);
 
 	where.y += font->ttc.ascent * scale;
+	pthread_mutex_lock(&mui_font_mutex);
 	for (uint ch = 0; text[ch] && ch < text_len; ch++) {
 		if (stb_ttc__UTF8_Decode(&state, &cp, text[ch]) != UTF8_ACCEPT)
 			continue;
@@ -176,6 +187,7 @@ mui_font_text_draw(
 				pxpos, where.y + gc->y0, pw, ph);
 		xpos += gc->advance;
 	}
+	pthread_mutex_unlock(&mui_font_mutex);
 	pixman_image_unref(fill);
 }
 
@@ -183,8 +195,8 @@ IMPLEMENT_C_ARRAY(mui_glyph_array);
 IMPLEMENT_C_ARRAY(mui_glyph_line_array);
 
 
-void
-mui_font_measure(
+static void
+_mui_font_measure(
 		mui_font_t *font,
 		c2_rect_t bbox,
 		const char *text,
@@ -353,6 +365,20 @@ mui_font_measure(
 	}
 }
 
+void
+mui_font_measure(
+		mui_font_t *font,
+		c2_rect_t bbox,
+		const char *text,
+		uint text_len,
+		mui_glyph_line_array_t *lines,
+		mui_text_e flags)
+{
+	pthread_mutex_lock(&mui_font_mutex);
+	_mui_font_measure(font, bbox, text, text_len, lines, flags);
+	pthread_mutex_unlock(&mui_font_mutex);
+}
+
 void
 mui_font_measure_clear(
 		mui_glyph_line_array_t *lines)
@@ -382,6 +408,7 @@ mui_font_measure_draw(
 
 	mui_drawable_t * src = &font->font;
 	mui_drawable_t * dst = dr;
+	pthread_mutex_lock(&mui_font_mutex);
 	_mui_font_pixman_prep(font);
 	for (uint li = 0; li < lines->count; li++) {
 		mui_glyph_array_t * line = &lines->e[li];
@@ -437,6 +464,7 @@ mui_font_measure_draw(
 			}
 		}
 	}
+	pthread_mutex_unlock(&mui_font_mutex);
 	pixman_image_unref(fill);
 }
 
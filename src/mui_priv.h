@@ -20,6 +20,34 @@ void
 mui_window_draw(
 		mui_window_t *win,
 		mui_drawable_t *dr);
+/* Clears the 'dirty' flag of the controls that mui_window_draw() will draw
+ * for win->inval (and counts them), so that drawing it from several threads
+ * only reads the controls. Used by mui_draw_tiles(). */
+void
+mui_window_draw_prepare(
+		mui_window_t *win);
+// apply a pending mui_window_scroll() to 'dr', with it's current clip
+void
+mui_window_draw_scroll(
+		mui_window_t *win,
+		mui_drawable_t *dr);
+// same as mui_window_draw, but renders win->inval into win->backing
+void
+mui_window_draw_backing(
+		mui_window_t *win);
+/*
+ * Draw the windows (with their inval region as clip) using several threads,
+ * if mui_t draw_threads allows it. Returns false if it didn't draw anything,
+ * and mui_draw() should do it itself.
+ */
+bool
+mui_draw_tiles(
+		mui_t *ui,
+		mui_drawable_t *dr);
+// stops the mui_draw_tiles() threads, and frees their drawables
+void
+mui_draw_tiles_dispose(
+		mui_t *ui);
 bool
 mui_window_handle_mouse(
 		mui_window_t *win,
@@ -51,6 +79,10 @@ bool
 mui_control_event(
 		mui_control_t * c,
 		mui_event_t * 	ev );
+// a new pixman image on the pixels of 'pix', the caller unrefs it
+union pixman_image *
+mui_pixmap_make_pixman(
+		mui_pixmap_t * pix);
 
 
 /* This is common to:
@@ -20,6 +20,11 @@ enum mui_window_part_e {
 	MUI_WINDOW_PART_COUNT,
 };
 
+static void
+_mui_window_inval_others(
+		mui_window_t *win,
+		c2_rect_t * r);
+
 static void
 mui_window_update_rects(
 		mui_window_t *win,
@@ -159,7 +164,9 @@ mui_window_create(
 	TAILQ_INIT(&w->controls);
 	STAILQ_INIT(&w->actions);
 	pixman_region32_init(&w->inval);
+	pixman_region32_init(&w->visible);
 	TAILQ_INSERT_HEAD(&ui->windows, w, self);
+	ui->window_stack_gen++;
 	mui_window_select(w); // place it in it's own layer
 	mui_font_t * main = mui_font_find(ui, "main");
 	mui_window_update_rects(w, main);
@@ -175,6 +182,8 @@ _mui_window_free(
 	if (!win)
 		return;
 	pixman_region32_fini(&win->inval);
+	pixman_region32_fini(&win->visible);
+	mui_drawable_dispose(win->backing);
 	mui_control_t * c;
 	while ((c = TAILQ_FIRST(&win->controls))) {
 		mui_control_dispose(c);
@@ -213,6 +222,7 @@ mui_window_dispose(
 		win->flags.hidden = true;
 		struct mui_t *ui = win->ui;
 		TAILQ_REMOVE(&ui->windows, win, self);
+		ui->window_stack_gen++;
 		mui_window_dispose_actions(win);
 		if (was_front) {
 			mui_window_t * front = mui_window_front(ui);
@@ -247,8 +257,31 @@ mui_window_draw(
 	struct cg_ctx_t * cg 	= mui_drawable_get_cg(dr);
 	cg_save(cg);
 //	cg_translate(cg, content.l, content.t);
+	/*
+	 * Only draw the controls that touch the clip region. The frame is
+	 * outset a bit, as some controls (default button, focus) draw their
+	 * frame slightly outside. Note that being dirty isn't enough to skip
+	 * the others, the window background was repainted under the clip.
+	 */
 	mui_control_t * c, *safe;
 	TAILQ_FOREACH_SAFE(c, &win->controls, self, safe) {
+		c2_rect_t f = c->frame;
+		c2_rect_offset(&f, win->content.l, win->content.t);
+		c2_rect_inset(&f, -2, -2);
+		// atomic, as mui_draw_tiles() can call us from several threads
+		if (!mui_drawable_clip_intersects(dr, &f)) {
+			__atomic_add_fetch(&win->ui->control_stats.culled, 1,
+						__ATOMIC_RELAXED);
+			continue;
+		}
+		__atomic_add_fetch(&win->ui->control_stats.drawn, 1,
+					__ATOMIC_RELAXED);
+		// already cleared by mui_window_draw_prepare() with threads
+		if (c->flags.dirty) {
+			__atomic_add_fetch(&win->ui->control_stats.dirty, 1,
+						__ATOMIC_RELAXED);
+			c->flags.dirty = 0;
+		}
 		mui_control_draw(win, c, dr);
 	}
 	cg_restore(cg);
@@ -256,6 +289,92 @@ mui_window_draw(
 	mui_drawable_clip_pop(dr);
 }
 
+void
+mui_window_draw_prepare(
+		mui_window_t *win)
+{
+	if (!win || win->flags.hidden)
+		return;
+	mui_control_t * c;
+	TAILQ_FOREACH(c, &win->controls, self) {
+		if (!c->flags.dirty)
+			continue;
+		// same test as mui_window_draw(), against the whole inval
+		c2_rect_t f = c->frame;
+		c2_rect_offset(&f, win->content.l, win->content.t);
+		c2_rect_inset(&f, -2, -2);
+		if (pixman_region32_contains_rectangle(&win->inval,
+				(pixman_box32_t*)&f) == PIXMAN_REGION_OUT)
+			continue;
+		win->ui->control_stats.dirty++;
+		c->flags.dirty = 0;
+	}
+}
+
+/*
+ * Apply any pending mui_window_scroll() to the pixels of 'dr', what could
+ * not be moved (exposed, or clipped out) is added to the window inval.
+ */
+void
+mui_window_draw_scroll(
+		mui_window_t *win,
+		mui_drawable_t *dr)
+{
+	if (!win || c2_rect_isempty(&win->scroll.rect))
+		return;
+	c2_rect_t r = win->scroll.rect;
+	c2_rect_offset(&r, win->content.l, win->content.t);
+	pixman_region32_t update = {};
+	mui_drawable_scroll(dr, &r,
+			win->scroll.delta.x, win->scroll.delta.y, &update);
+	pixman_region32_union(&win->inval, &win->inval, &update);
+	pixman_region32_fini(&update);
+	win->scroll.rect = (c2_rect_t){};
+	win->scroll.delta = (c2_pt_t){};
+}
+
+/*
+ * Render the dirty part of the window in it's own backing store. The
+ * backing store is window sized, so the frame and content rectangles are
+ * temporarily moved to 0,0 while drawing; all the drawing code is relative
+ * to these anyway.
+ */
+void
+mui_window_draw_backing(
+		mui_window_t *win)
+{
+	if (!win || win->flags.hidden)
+		return;
+	c2_pt_t size = C2_PT(c2_rect_width(&win->frame),
+						c2_rect_height(&win->frame));
+	mui_drawable_t * b = win->backing;
+	if (b && (b->pix.size.x != size.x || b->pix.size.y != size.y)) {
+		mui_drawable_dispose(b);
+		b = win->backing = NULL;
+	}
+	if (!b) {
+		b = win->backing = mui_drawable_new(size, 32, NULL, 0);
+		pixman_region32_reset(&win->inval, (pixman_box32_t*)&win->frame);
+	}
+	if (!pixman_region32_not_empty(&win->inval) &&
+			c2_rect_isempty(&win->scroll.rect))
+		return;
+	c2_pt_t o = win->frame.tl;
+	c2_rect_offset(&win->frame, -o.x, -o.y);
+	c2_rect_offset(&win->content, -o.x, -o.y);
+	pixman_region32_translate(&win->inval, -o.x, -o.y);
+
+	mui_drawable_set_clip(b, NULL);
+	mui_window_draw_scroll(win, b);
+	mui_drawable_clip_push_region(b, &win->inval);
+	pixman_region32_clear(&win->inval);
+	mui_window_draw(win, b);
+	mui_drawable_set_clip(b, NULL);
+
+	c2_rect_offset(&win->frame, o.x, o.y);
+	c2_rect_offset(&win->content, o.x, o.y);
+}
+
 /*
  * Keys are passed first to the control that is in focus (if any), then
  * to all the others in sequence until someone handles it (or not).
@@ -361,9 +480,36 @@ mui_window_handle_mouse(
 					c2_rect_t o;
 					c2_rect_clip_rect(&title_bar, &screen, &o);
 					if (c2_rect_width(&o) > 10 && c2_rect_height(&o) > 10) {
-						mui_window_inval(win, NULL);	// old frame
+						mui_t * ui = win->ui;
+						c2_pt_t d = C2_PT(frame.l - win->frame.l,
+										frame.t - win->frame.t);
+						/* With a backing store, the window pixels are
+						 * already there, only the screen needs compositing.
+						 * Otherwise, the windows below need to redraw what
+						 * we uncover, but our own pixels are moved on
+						 * screen by mui_draw() */
+						pixman_region32_union_rect(&ui->inval, &ui->inval,
+								win->frame.l, win->frame.t,
+								c2_rect_width(&win->frame),
+								c2_rect_height(&win->frame));
+						// pending damage moves with the window, either way
+						pixman_region32_translate(&win->inval, d.x, d.y);
+						if (!ui->flags.backing_store || !win->backing) {
+							_mui_window_inval_others(win, &win->frame);
+							/* a drag on top of a pending one stays valid if
+							 * nothing else changed in between */
+							bool fresh = (!win->moved.x && !win->moved.y) ||
+									win->moved_gen == ui->window_stack_gen;
+							c2_pt_offset(&win->moved, d.x, d.y);
+							ui->window_stack_gen++;
+							if (fresh)
+								win->moved_gen = ui->window_stack_gen;
+						}
+						c2_rect_offset(&win->content, d.x, d.y);
 						win->frame = frame;
-						mui_window_inval(win, NULL);	// new frame
+						pixman_region32_union_rect(&ui->inval, &ui->inval,
+								frame.l, frame.t,
+								c2_rect_width(&frame), c2_rect_height(&frame));
 					}
 				}
 			//	mui_window_inval(win, NULL);
@@ -401,6 +547,24 @@ mui_window_handle_mouse(
 	return false;
 }
 
+/*
+ * Invalidate 'r' (screen coordinates) in all the windows it touches,
+ * except 'win'. mui_window_inval() does the screen.
+ */
+static void
+_mui_window_inval_others(
+		mui_window_t *win,
+		c2_rect_t * r)
+{
+	mui_window_t * w, *save;
+	TAILQ_FOREACH_SAFE(w, &win->ui->windows, self, save) {
+		if (w == win || !c2_rect_intersect_rect(&w->frame, r))
+			continue;
+		pixman_region32_union_rect(&w->inval, &w->inval,
+			r->l, r->t, c2_rect_width(r), c2_rect_height(r));
+	}
+}
+
 void
 mui_window_inval(
 		mui_window_t *win,
@@ -415,15 +579,7 @@ mui_window_inval(
 	//	printf("%s %s inval %s (whole)\n", __func__, win->title, c2_rect_as_str(&frame));
 		pixman_region32_reset(&win->inval, (pixman_box32_t*)&frame);
 		forward = frame;
-
-		mui_window_t * w, *save;
-		TAILQ_FOREACH_SAFE(w, &win->ui->windows, self, save) {
-			if (w == win || !c2_rect_intersect_rect(&w->frame, &forward))
-				continue;
-			pixman_region32_union_rect(&w->inval, &w->inval,
-				forward.l, forward.t,
-				c2_rect_width(&forward), c2_rect_height(&forward));
-		}
+		_mui_window_inval_others(win, &forward);
 	} else {
 		c2_rect_t local = *r;
 		c2_rect_offset(&local, win->content.l, win->content.t);
@@ -440,6 +596,43 @@ mui_window_inval(
 			c2_rect_width(&forward), c2_rect_height(&forward));
 }
 
+void
+mui_window_scroll(
+		mui_window_t *	win,
+		c2_rect_t * 	r,
+		int 			dx,
+		int 			dy)
+{
+	if (!win || win->flags.hidden || !r || c2_rect_isempty(r))
+		return;
+	if (!dx && !dy)
+		return;
+	c2_rect_t local = *r;
+	c2_rect_offset(&local, win->content.l, win->content.t);
+	bool same = c2_rect_equal(&win->scroll.rect, r);
+	if (!same && !c2_rect_isempty(&win->scroll.rect)) {
+		// already scrolling something else, can't do both
+		mui_window_inval(win, r);
+		return;
+	}
+	c2_pt_t delta = win->scroll.delta;
+	c2_pt_offset(&delta, dx, dy);
+	/* if the pixels in there are stale, or scrolled off, redraw the lot */
+	if (abs(delta.x) >= c2_rect_width(r) ||
+			abs(delta.y) >= c2_rect_height(r) ||
+			pixman_region32_contains_rectangle(&win->inval,
+					(pixman_box32_t*)&local) != PIXMAN_REGION_OUT) {
+		win->scroll.rect = (c2_rect_t){};
+		win->scroll.delta = (c2_pt_t){};
+		mui_window_inval(win, r);
+		return;
+	}
+	win->scroll.rect = *r;
+	win->scroll.delta = delta;
+	pixman_region32_union_rect(&win->ui->inval, &win->ui->inval,
+			local.l, local.t, c2_rect_width(&local), c2_rect_height(&local));
+}
+
 mui_window_t *
 mui_window_front(
 		struct mui_t *ui)
@@ -484,6 +677,7 @@ mui_window_select(
 		goto done;
 	res = true;
 	mui_window_inval(win, NULL);
+	win->ui->window_stack_gen++;
 	TAILQ_REMOVE(&win->ui->windows, win, self);
 	mui_window_t *w, *save;
 	TAILQ_FOREACH_SAFE(w, &win->ui->windows, self, save) {
@@ -25,6 +25,7 @@
  *
  */
 
+#include <pthread.h>
 #include "xft.h"
 
 /*
@@ -419,6 +420,17 @@ typedef ptrdiff_t		XCG_FT_PtrDist;
 
 #define XCG_FT_MINIMUM_POOL_SIZE 	8192
 #define XCG_FT_MAX_GRAY_SPANS		256
+/* initial size of a XCG_FT_Raster_Pool, they grow from there */
+#define XCG_FT_POOL_SIZE			(XCG_FT_MINIMUM_POOL_SIZE * 4)
+#define XCG_FT_MAX_POOL_SIZE		(XCG_FT_MINIMUM_POOL_SIZE * 64)
+/* band threads: cell pool each, max threads, and min rows/pixels per thread */
+#define XCG_FT_BAND_POOL_SIZE		(XCG_FT_MINIMUM_POOL_SIZE * 8)
+#define XCG_FT_MAX_BAND_THREADS		16
+#define XCG_FT_BAND_MIN_ROWS		32
+#define XCG_FT_BAND_MIN_AREA		(256 * 256)
+/* outlines up to that many pixels wide and high use the dense rasterizer,
+ * the width is so a row's columns (and one on each side) fit a 64 bit mask */
+#define XCG_FT_DENSE_MAX			62
 
 #define RAS_ARG   					PWorker worker
 #define RAS_ARG_					PWorker worker,
@@ -483,8 +495,55 @@ typedef struct TWorker_ {
 	long buffer_size;
 	PCell *ycells;
 	TPos ycount;
+	int threads;
+	/* band threads keep all their spans here, unmerged, see gray_hline() */
+	struct {
+		XCG_FT_Span *data;
+		int size, capacity;
+	} band_spans;
+	int record;
+	XCG_FT_Raster_Pool *pool;
+	/* dense mode accumulation buffer, see gray_convert_dense() */
+	TArea *dense;
+	long dense_pitch;
+	uint64_t *dense_used;
 } TWorker, *PWorker;
 
+/*
+ * Makes sure the pool has at least size bytes, the content is not kept.
+ * Returns NULL if that fails, the pool keeps its current buffer then.
+ */
+static void * gray_pool_reserve(XCG_FT_Raster_Pool * pool, long size)
+{
+	if(pool->size < size)
+	{
+		void *buffer = malloc(size);
+		if(!buffer)
+			return NULL;
+		free(pool->buffer);
+		pool->buffer = buffer;
+		pool->size = size;
+		pool->band_size = 0;
+	}
+	return pool->buffer;
+}
+
+static void gray_workers_done(struct XCG_FT_Band_Workers_ * w);
+
+void XCG_FT_Raster_Pool_Done(XCG_FT_Raster_Pool * pool)
+{
+	if(pool->workers)
+		gray_workers_done(pool->workers);
+	if(pool->threads)
+	{
+		for(int i = 0; i < XCG_FT_MAX_BAND_THREADS; i++)
+			XCG_FT_Raster_Pool_Done(&pool->threads[i]);
+		free(pool->threads);
+	}
+	free(pool->buffer);
+	memset(pool, 0, sizeof(*pool));
+}
+
 static void gray_init_cells(RAS_ARG_ void* buffer, long byte_size)
 {
 	ras.buffer = buffer;
@@ -565,6 +624,23 @@ static void gray_record_cell( RAS_ARG)
 {
 	if( ras.area | ras.cover)
 	{
+		if(ras.dense)
+		{
+			TArea *d = ras.dense + ras.ey * ras.dense_pitch + ras.ex + 1;
+			uint64_t *used = ras.dense_used + ras.ey;
+			uint64_t bits = (uint64_t)3 << (ras.ex + 1);
+			if((*used & bits) != bits)
+			{
+				if(!(*used & (bits >> 1 & bits)))
+					d[0] = 0;
+				if(!(*used & (bits << 1 & bits)))
+					d[1] = 0;
+				*used |= bits;
+			}
+			d[0] += ras.cover * ( ONE_PIXEL * 2) - ras.area;
+			d[1] += ras.area;
+			return;
+		}
 		PCell cell = gray_find_cell( RAS_VAR);
 		cell->area += ras.area;
 		cell->cover += ras.cover;
@@ -973,6 +1049,40 @@ static int gray_move_to(const XCG_FT_Vector *to, PWorker worker)
 	return 0;
 }
 
+static void gray_emit_span( RAS_ARG_ TCoord x, TCoord y, int acount, int coverage)
+{
+	XCG_FT_Span *span;
+	int count;
+	int skip;
+	count = ras.num_gray_spans;
+	span = ras.gray_spans + count - 1;
+	if(count > 0 && span->y == y && span->x + span->len == x && span->coverage == coverage)
+	{
+		span->len = span->len + acount;
+		return;
+	}
+	if(count >= XCG_FT_MAX_GRAY_SPANS)
+	{
+		if( ras.render_span && count > ras.skip_spans)
+		{
+			skip = ras.skip_spans > 0 ? ras.skip_spans : 0;
+			ras.render_span( ras.num_gray_spans - skip,
+			ras.gray_spans + skip,
+			ras.render_span_data);
+		}
+		ras.skip_spans -= ras.num_gray_spans;
+		ras.num_gray_spans = 0;
+		span = ras.gray_spans;
+	}
+	else
+		span++;
+	span->x = x;
+	span->len = acount;
+	span->y = y;
+	span->coverage = (unsigned char)coverage;
+	ras.num_gray_spans++;
+}
+
 static void gray_hline( RAS_ARG_ TCoord x, TCoord y, TPos area, int acount)
 {
 	int coverage;
@@ -1001,36 +1111,21 @@ static void gray_hline( RAS_ARG_ TCoord x, TCoord y, TPos area, int acount)
 		y = (1 << 23) - 1;
 	if(coverage)
 	{
-		XCG_FT_Span *span;
-		int count;
-		int skip;
-		count = ras.num_gray_spans;
-		span = ras.gray_spans + count - 1;
-		if(count > 0 && span->y == y && span->x + span->len == x && span->coverage == coverage)
-		{
-			span->len = span->len + acount;
-			return;
-		}
-		if(count >= XCG_FT_MAX_GRAY_SPANS)
+		if(ras.record)
 		{
-			if( ras.render_span && count > ras.skip_spans)
+			if(ras.band_spans.size == ras.band_spans.capacity)
 			{
-				skip = ras.skip_spans > 0 ? ras.skip_spans : 0;
-				ras.render_span( ras.num_gray_spans - skip,
-				ras.gray_spans + skip,
-				ras.render_span_data);
+				ras.band_spans.capacity = ras.band_spans.capacity ? ras.band_spans.capacity * 2 : XCG_FT_MAX_GRAY_SPANS;
+				ras.band_spans.data = realloc(ras.band_spans.data, ras.band_spans.capacity * sizeof(XCG_FT_Span));
 			}
-			ras.skip_spans -= ras.num_gray_spans;
-			ras.num_gray_spans = 0;
-			span = ras.gray_spans;
+			XCG_FT_Span *span = ras.band_spans.data + ras.band_spans.size++;
+			span->x = x;
+			span->len = acount;
+			span->y = y;
+			span->coverage = (unsigned char)coverage;
+			return;
 		}
-		else
-			span++;
-		span->x = x;
-		span->len = acount;
-		span->y = y;
-		span->coverage = (unsigned char)coverage;
-		ras.num_gray_spans++;
+		gray_emit_span( RAS_VAR_ x, y, acount, coverage);
 	}
 }
 
@@ -1220,38 +1315,72 @@ static int gray_convert_glyph_inner(RAS_ARG)
 	return error;
 }
 
-static int gray_convert_glyph(RAS_ARG)
+/*
+ * Small outlines skip the cell lists. Each cell is added to a dense buffer,
+ * one slot per pixel plus one on each side, as deltas: a row's running sum
+ * gives the same area gray_sweep() calculates for each pixel. Each row has
+ * a mask of the slots used, so the buffer doesn't need clearing, and the
+ * sweep only visits those: the area is the same until the next one.
+ * No cell lookup, no sorting, and the buffer is a few KB for glyph sized
+ * shapes. Same spans as the cell version once gray_emit_span() merged them.
+ */
+static int gray_convert_dense(RAS_ARG)
+{
+	TCoord x, y, start;
+	TArea sum, area;
+	int error;
+
+	ras.dense_used = (uint64_t*)ras.buffer;
+	ras.dense = (TArea*)(ras.dense_used + ras.count_ey);
+	ras.dense_pitch = ras.count_ex + 2;
+	memset(ras.dense_used, 0, ras.count_ey * sizeof(uint64_t));
+	ras.num_cells = 0;
+	ras.invalid = 1;
+	error = gray_convert_glyph_inner( RAS_VAR);
+	for(y = 0; !error && y < ras.count_ey; y++)
+	{
+		TArea *d = ras.dense + y * ras.dense_pitch;
+		uint64_t used = ras.dense_used[y];
+		sum = 0;
+		start = 0;
+		while(used)
+		{
+			int i = __builtin_ctzll(used);
+			used &= used - 1;
+			x = i - 1;
+			if(x >= ras.count_ex)
+				break;
+			area = sum + d[i];
+			if(x >= 0 && area != sum)
+			{
+				if(sum != 0)
+					gray_hline( RAS_VAR_ start, y, sum, x - start);
+				start = x;
+			}
+			sum = area;
+		}
+		if(sum != 0)
+			gray_hline( RAS_VAR_ start, y, sum, ras.count_ex - start);
+	}
+	ras.dense = NULL;
+	return error;
+}
+
+/* Renders rows min..max_y in bands, as many as fit in the cell buffer */
+static int gray_convert_bands(RAS_ARG_ TPos min_y, TPos max_y)
 {
 	TBand bands[40];
 	TBand *volatile band;
 	int volatile n, num_bands;
-	TPos volatile min, max, max_y;
-	XCG_FT_BBox *clip;
-	int skip;
+	TPos volatile min, max;
 
-	ras.num_gray_spans = 0;
-	gray_compute_cbox( RAS_VAR);
-	clip = &ras.clip_box;
-	if( ras.max_ex <= clip->xMin || ras.min_ex >= clip->xMax || ras.max_ey <= clip->yMin || ras.min_ey >= clip->yMax)
-		return 0;
-	if( ras.min_ex < clip->xMin)
-		ras.min_ex = clip->xMin;
-	if( ras.min_ey < clip->yMin)
-		ras.min_ey = clip->yMin;
-	if( ras.max_ex > clip->xMax)
-		ras.max_ex = clip->xMax;
-	if( ras.max_ey > clip->yMax)
-		ras.max_ey = clip->yMax;
-	ras.count_ex = ras.max_ex - ras.min_ex;
-	ras.count_ey = ras.max_ey - ras.min_ey;
-	num_bands = (int)(( ras.max_ey - ras.min_ey) / ras.band_size);
+	num_bands = (int)((max_y - min_y) / ras.band_size);
 	if(num_bands == 0)
 		num_bands = 1;
 	if(num_bands >= 39)
 		num_bands = 39;
 	ras.band_shoot = 0;
-	min = ras.min_ey;
-	max_y = ras.max_ey;
+	min = min_y;
 	for(n = 0; n < num_bands; n++, min = max)
 	{
 		max = min + ras.band_size;
@@ -1308,7 +1437,7 @@ ReduceBands:
 			{
 				return ErrRaster_OutOfMemory;
 			}
-			if(bottom - top >= ras.band_size)
+			if(top - bottom >= ras.band_size)
 				ras.band_shoot++;
 			band[1].min = bottom;
 			band[1].max = middle;
@@ -1317,6 +1446,277 @@ ReduceBands:
 			band++;
 		}
 	}
+	return 0;
+}
+
+/* Band height for the current buffer, or the smaller one that worked last time */
+static void gray_start_bands(RAS_ARG)
+{
+	ras.band_size = (int)(ras.buffer_size / (long)(sizeof(TCell) * 8));
+	if(ras.pool && ras.pool->band_size > 0 && ras.pool->band_size < ras.band_size)
+		ras.band_size = ras.pool->band_size;
+}
+
+/*
+ * If full bands had to be split, a pool grows for the next time, up to a
+ * point. Past that (or without a pool) smaller bands are used instead.
+ * The cells are not used after this, so the buffer can go.
+ */
+static void gray_end_bands(RAS_ARG)
+{
+	if(ras.pool && ras.band_shoot > 0 && ras.pool->size < XCG_FT_MAX_POOL_SIZE)
+	{
+		gray_pool_reserve(ras.pool, ras.pool->size * 2);
+		return;
+	}
+	if( ras.band_shoot > 8 && ras.band_size > 16)
+		ras.band_size = ras.band_size / 2;
+	if(ras.pool)
+		ras.pool->band_size = ras.band_size;
+}
+
+/*
+ * Band threads. The rows are split between the threads, each with its own
+ * worker and cell buffer, and they record their spans instead of calling
+ * render_span. These are then passed through gray_emit_span() in row order,
+ * so the caller gets exactly the same spans, in the same batches, as with
+ * the serial version.
+ */
+typedef struct TBandThread_ {
+	TWorker worker;
+	TPos min, max;
+	int error;
+} TBandThread;
+
+static void * gray_band_thread(void * param)
+{
+	TBandThread *t = param;
+	PWorker worker = &t->worker;
+	long size = XCG_FT_BAND_POOL_SIZE;
+	if(ras.pool && ras.pool->size > size)
+		size = ras.pool->size;
+	do {
+		void *buffer = ras.pool ? gray_pool_reserve(ras.pool, size) : malloc(size);
+		if(!buffer)
+		{
+			t->error = ErrRaster_Memory_Overflow;
+			break;
+		}
+		gray_init_cells( RAS_VAR_ buffer, size);
+		gray_start_bands( RAS_VAR);
+		ras.band_spans.size = 0;
+		t->error = gray_convert_bands( RAS_VAR_ t->min, t->max);
+		if(!ras.pool)
+			free(buffer);
+		size *= 2;
+	} while(t->error == ErrRaster_OutOfMemory);
+	if(!t->error)
+		gray_end_bands( RAS_VAR);
+	return NULL;
+}
+
+/*
+ * The band threads of a pool, started when first needed and kept until
+ * XCG_FT_Raster_Pool_Done(). They wait on 'wake' for 'frame' to change,
+ * do their band of 'bands' (if there is one), and the last one done with
+ * the frame signals 'done'. Band 0 is done by the thread that renders.
+ */
+typedef struct XCG_FT_Band_Workers_ {
+	pthread_mutex_t lock;
+	pthread_cond_t wake, done;
+	unsigned frame;
+	int pending;
+	int quit;
+	TBandThread *bands;
+	int count;
+	int started;	/* slots 1 to 'started' have a thread */
+	struct TBandSlot_ {
+		struct XCG_FT_Band_Workers_ *set;
+		int index;
+		unsigned frame;	/* the frame it was started at */
+		pthread_t thread;
+	} slot[XCG_FT_MAX_BAND_THREADS];
+} TBandWorkers;
+
+static void * gray_worker_thread(void * param)
+{
+	struct TBandSlot_ *slot = param;
+	TBandWorkers *w = slot->set;
+	unsigned frame = slot->frame;
+
+	pthread_mutex_lock(&w->lock);
+	for(;;)
+	{
+		while(!w->quit && w->frame == frame)
+			pthread_cond_wait(&w->wake, &w->lock);
+		if(w->quit)
+			break;
+		frame = w->frame;
+		TBandThread *t = slot->index < w->count ? &w->bands[slot->index] : NULL;
+		pthread_mutex_unlock(&w->lock);
+		if(t && t->min < t->max)
+			gray_band_thread(t);
+		pthread_mutex_lock(&w->lock);
+		if(--w->pending == 0)
+			pthread_cond_signal(&w->done);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static void gray_workers_done(TBandWorkers * w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->quit = 1;
+	pthread_cond_broadcast(&w->wake);
+	pthread_mutex_unlock(&w->lock);
+	for(int i = 1; i <= w->started; i++)
+		pthread_join(w->slot[i].thread, NULL);
+	pthread_cond_destroy(&w->done);
+	pthread_cond_destroy(&w->wake);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
+
+/* Returns how many threads there are for bands 1 to count - 1 */
+static int gray_workers_start(XCG_FT_Raster_Pool * pool, int count)
+{
+	TBandWorkers *w = pool->workers;
+	if(!w)
+	{
+		w = pool->workers = calloc(1, sizeof(TBandWorkers));
+		if(!w)
+			return 0;
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->wake, NULL);
+		pthread_cond_init(&w->done, NULL);
+	}
+	/* no render is in progress, so 'frame' can't change under us */
+	while(w->started < count - 1)
+	{
+		struct TBandSlot_ *slot = &w->slot[w->started + 1];
+		slot->set = w;
+		slot->index = w->started + 1;
+		slot->frame = w->frame;
+		if(pthread_create(&slot->thread, NULL, gray_worker_thread, slot) != 0)
+			break;
+		w->started++;
+	}
+	return w->started;
+}
+
+static int gray_convert_threaded(RAS_ARG_ int count)
+{
+	TBandThread *threads = malloc(sizeof(TBandThread) * count);
+	TPos rows = (ras.max_ey - ras.min_ey + count - 1) / count;
+	int i, k, started, error = 0;
+
+	if(!threads)
+		return gray_convert_bands( RAS_VAR_ ras.min_ey, ras.max_ey);
+	if(!ras.pool->threads)
+		ras.pool->threads = calloc(XCG_FT_MAX_BAND_THREADS, sizeof(XCG_FT_Raster_Pool));
+	for(i = 0; i < count; i++)
+	{
+		TBandThread *t = &threads[i];
+		t->worker = ras;
+		t->worker.pool = ras.pool->threads ? &ras.pool->threads[i] : NULL;
+		t->worker.record = 1;
+		t->worker.band_spans.data = NULL;
+		t->worker.band_spans.size = t->worker.band_spans.capacity = 0;
+		t->min = ras.min_ey + i * rows;
+		t->max = t->min + rows;
+		if(t->max > ras.max_ey)
+			t->max = ras.max_ey;
+		t->error = 0;
+	}
+	started = gray_workers_start(ras.pool, count);
+	TBandWorkers *w = ras.pool->workers;
+	if(started)
+	{
+		pthread_mutex_lock(&w->lock);
+		w->bands = threads;
+		w->count = count;
+		w->pending = started;
+		w->frame++;
+		pthread_cond_broadcast(&w->wake);
+		pthread_mutex_unlock(&w->lock);
+	}
+	/* band 0, and the ones there is no thread for */
+	for(i = 0; i < count; i++)
+	{
+		TBandThread *t = &threads[i];
+		if((i == 0 || i > started) && t->min < t->max)
+			gray_band_thread(t);
+	}
+	if(started)
+	{
+		pthread_mutex_lock(&w->lock);
+		while(w->pending)
+			pthread_cond_wait(&w->done, &w->lock);
+		w->bands = NULL;
+		w->count = 0;
+		pthread_mutex_unlock(&w->lock);
+	}
+	for(i = 0; i < count; i++)
+	{
+		TBandThread *t = &threads[i];
+		if(t->error && !error)
+			error = t->error;
+		for(k = 0; !error && k < t->worker.band_spans.size; k++)
+		{
+			XCG_FT_Span *span = &t->worker.band_spans.data[k];
+			gray_emit_span( RAS_VAR_ span->x, span->y, span->len, span->coverage);
+		}
+		free(t->worker.band_spans.data);
+	}
+	free(threads);
+	return error;
+}
+
+static int gray_convert_glyph(RAS_ARG)
+{
+	XCG_FT_BBox *clip;
+	int skip, count, error;
+
+	ras.num_gray_spans = 0;
+	gray_compute_cbox( RAS_VAR);
+	clip = &ras.clip_box;
+	if( ras.max_ex <= clip->xMin || ras.min_ex >= clip->xMax || ras.max_ey <= clip->yMin || ras.min_ey >= clip->yMax)
+		return 0;
+	if( ras.min_ex < clip->xMin)
+		ras.min_ex = clip->xMin;
+	if( ras.min_ey < clip->yMin)
+		ras.min_ey = clip->yMin;
+	if( ras.max_ex > clip->xMax)
+		ras.max_ex = clip->xMax;
+	if( ras.max_ey > clip->yMax)
+		ras.max_ey = clip->yMax;
+	ras.count_ex = ras.max_ex - ras.min_ex;
+	ras.count_ey = ras.max_ey - ras.min_ey;
+	if( ras.count_ex <= XCG_FT_DENSE_MAX && ras.count_ey <= XCG_FT_DENSE_MAX)
+	{
+		long size = ras.count_ey * (sizeof(uint64_t) + (ras.count_ex + 2) * sizeof(TArea));
+		/* nothing is in the buffer yet, so a pool can grow here */
+		if(ras.pool && size > ras.buffer_size && gray_pool_reserve(ras.pool, size))
+			gray_init_cells( RAS_VAR_ ras.pool->buffer, ras.pool->size);
+		if(size <= ras.buffer_size)
+		{
+			error = gray_convert_dense( RAS_VAR);
+			goto Flush;
+		}
+	}
+	count = ras.threads;
+	if(count > XCG_FT_MAX_BAND_THREADS)
+		count = XCG_FT_MAX_BAND_THREADS;
+	if(count > ras.count_ey / XCG_FT_BAND_MIN_ROWS)
+		count = (int)(ras.count_ey / XCG_FT_BAND_MIN_ROWS);
+	if(count > 1 && ras.pool && ras.count_ex * ras.count_ey >= XCG_FT_BAND_MIN_AREA)
+		error = gray_convert_threaded( RAS_VAR_ count);
+	else
+		error = gray_convert_bands( RAS_VAR_ ras.min_ey, ras.max_ey);
+Flush:
+	if(error)
+		return error;
 	if( ras.render_span && ras.num_gray_spans > ras.skip_spans)
 	{
 		skip = ras.skip_spans > 0 ? ras.skip_spans : 0;
@@ -1325,8 +1725,7 @@ ReduceBands:
 		ras.render_span_data);
 	}
 	ras.skip_spans -= ras.num_gray_spans;
-	if( ras.band_shoot > 8 && ras.band_size > 16)
-		ras.band_size = ras.band_size / 2;
+	gray_end_bands( RAS_VAR);
 	return 0;
 }
 
@@ -1360,30 +1759,56 @@ static int gray_raster_render(RAS_ARG_ void * buffer, long buffer_size, const XC
 	ras.outline = *outline;
 	ras.num_cells = 0;
 	ras.invalid = 1;
-	ras.band_size = (int)(buffer_size / (long)(sizeof(TCell) * 8));
+	ras.pool = params->pool;
+	ras.dense = NULL;
+	ras.band_shoot = 0;
+	gray_start_bands( RAS_VAR);
 	ras.render_span = (XCG_FT_Raster_Span_Func)params->gray_spans;
 	ras.render_span_data = params->user;
+	ras.threads = params->threads;
+	ras.record = 0;
 	return gray_convert_glyph( RAS_VAR);
 }
 
 void XCG_FT_Raster_Render(const XCG_FT_Raster_Params * params)
 {
 	char stack[XCG_FT_MINIMUM_POOL_SIZE];
-	size_t length = XCG_FT_MINIMUM_POOL_SIZE;
-
+	long length = XCG_FT_MINIMUM_POOL_SIZE;
+	XCG_FT_Raster_Pool *pool = params->pool;
+	void *buffer = stack;
+
+	/*
+	 * With a pool, the buffer is kept, and only grows the first time(s).
+	 * If it can't be had, this renders from the stack, and retries with
+	 * its own buffers, as without a pool.
+	 */
+	if(pool)
+	{
+		length = pool->size > XCG_FT_POOL_SIZE ? pool->size : XCG_FT_POOL_SIZE;
+		buffer = gray_pool_reserve(pool, length);
+		if(!buffer)
+		{
+			buffer = stack;
+			length = XCG_FT_MINIMUM_POOL_SIZE;
+			pool = NULL;
+		}
+	}
 	TWorker worker;
 	worker.skip_spans = 0;
 	int rendered_spans = 0;
-	int error = gray_raster_render(&worker, stack, length, params);
+	int error = gray_raster_render(&worker, buffer, length, params);
 	while(error == ErrRaster_OutOfMemory)
 	{
 		if(worker.skip_spans < 0)
 			rendered_spans += -worker.skip_spans;
 		worker.skip_spans = rendered_spans;
 		length *= 2;
-		void *heap = malloc(length);
-		error = gray_raster_render(&worker, heap, length, params);
-		free(heap);
+		buffer = pool ? gray_pool_reserve(pool, length) : malloc(length);
+		if(!buffer)
+			break;
+		error = gray_raster_render(&worker, buffer, length, params);
+		if(!pool)
+			free(buffer);
 	}
 }
 
@@ -2724,6 +3149,20 @@ void XCG_FT_Stroker_Export(XCG_FT_Stroker stroker, XCG_FT_Outline * outline)
 	XCG_FT_Stroker_ExportBorder(stroker, XCG_FT_STROKER_BORDER_RIGHT, outline);
 }
 
+/* Ends a contour started with BeginSubPath(), as ParseOutline() does */
+XCG_FT_Error XCG_FT_Stroker_EndContour(XCG_FT_Stroker stroker)
+{
+	XCG_FT_Error error;
+	if(stroker->first_point)
+	{
+		stroker->subpath_open = TRUE;
+		error = ft_stroker_subpath_start(stroker, 0, 0);
+		if(error)
+			return error;
+	}
+	return XCG_FT_Stroker_EndSubPath(stroker);
+}
+
 XCG_FT_Error XCG_FT_Stroker_ParseOutline(XCG_FT_Stroker stroker, const XCG_FT_Outline *outline)
 {
 	XCG_FT_Vector v_last;
@@ -2854,14 +3293,7 @@ Do_Conic:
 Close:
 		if(error)
 			goto Exit;
-		if(stroker->first_point)
-		{
-			stroker->subpath_open = TRUE;
-			error = ft_stroker_subpath_start(stroker, 0, 0);
-			if(error)
-				goto Exit;
-		}
-		error = XCG_FT_Stroker_EndSubPath(stroker);
+		error = XCG_FT_Stroker_EndContour(stroker);
 		if(error)
 			goto Exit;
 		first = last + 1;
@@ -95,17 +95,35 @@ typedef void (*XCG_FT_SpanFunc)(int count, const XCG_FT_Span * spans, void * use
 #define XCG_FT_RASTER_FLAG_DIRECT   0x2
 #define XCG_FT_RASTER_FLAG_CLIP     0x4
 
+/*
+ * Cell memory for the rasterizer, kept between renders by the owner. It grows
+ * when an outline doesn't fit, and remembers the band height that worked.
+ * Band threads get their own, in 'threads'; the threads themselves are
+ * started the first time they are needed, and kept in 'workers' until
+ * XCG_FT_Raster_Pool_Done(). Band threads are only used with a pool.
+ */
+typedef struct XCG_FT_Raster_Pool_ {
+	void * buffer;
+	long size;
+	int band_size;
+	struct XCG_FT_Raster_Pool_ * threads;
+	struct XCG_FT_Band_Workers_ * workers;
+} XCG_FT_Raster_Pool;
+
 typedef struct XCG_FT_Raster_Params_ {
 	const void * source;
 	int flags;
 	XCG_FT_SpanFunc gray_spans;
 	void * user;
 	XCG_FT_BBox clip_box;
+	int threads;	/* > 1 to split large outlines between that many threads */
+	XCG_FT_Raster_Pool * pool;	/* optional, otherwise allocated per render (and no threads) */
 } XCG_FT_Raster_Params;
 
 XCG_FT_Error XCG_FT_Outline_Check(XCG_FT_Outline * outline);
 void XCG_FT_Outline_Get_CBox(const XCG_FT_Outline * outline, XCG_FT_BBox * acbox);
 void XCG_FT_Raster_Render(const XCG_FT_Raster_Params * params);
+void XCG_FT_Raster_Pool_Done(XCG_FT_Raster_Pool * pool);
 
 /*
  * stroker
@@ -134,6 +152,11 @@ typedef enum XCG_FT_StrokerBorder_ {
 XCG_FT_Error XCG_FT_Stroker_New(XCG_FT_Stroker * astroker);
 void XCG_FT_Stroker_Set(XCG_FT_Stroker stroker, XCG_FT_Fixed radius, XCG_FT_Stroker_LineCap line_cap, XCG_FT_Stroker_LineJoin line_join, XCG_FT_Fixed miter_limit);
 XCG_FT_Error XCG_FT_Stroker_ParseOutline(XCG_FT_Stroker stroker, const XCG_FT_Outline * outline);
+/* to feed the stroker without an outline, ParseOutline() uses these */
+void XCG_FT_Stroker_Rewind(XCG_FT_Stroker stroker);
+XCG_FT_Error XCG_FT_Stroker_BeginSubPath(XCG_FT_Stroker stroker, XCG_FT_Vector * to, XCG_FT_Bool open);
+XCG_FT_Error XCG_FT_Stroker_LineTo(XCG_FT_Stroker stroker, XCG_FT_Vector * to);
+XCG_FT_Error XCG_FT_Stroker_EndContour(XCG_FT_Stroker stroker);
 XCG_FT_Error XCG_FT_Stroker_GetCounts(XCG_FT_Stroker stroker, XCG_FT_UInt * anum_points, XCG_FT_UInt * anum_contours);
 void XCG_FT_Stroker_Export(XCG_FT_Stroker stroker, XCG_FT_Outline * outline);
 void XCG_FT_Stroker_Done(XCG_FT_Stroker stroker);
@@ -0,0 +1,210 @@
+/*
+ * cg_comp_check.c
+ *
+ * Copyright (C) 2024 Michel Pollet <buserror@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Checks the vector cg_comp_* span functions against the scalar ones.
+ * cg.c is included here so the static maps and functions are visible;
+ * every map entry, and every vector width the CPU can run, is compared
+ * to the scalar version over random spans, with all the tail lengths,
+ * misaligned starts, and coverage 0, 255 and in between.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cg.c"
+
+#define CHECK_MAX_LEN	70
+#define CHECK_ROUNDS	2000
+
+typedef struct check_comp_t {
+	const char *			name;
+	cg_comp_function_t		ref;
+	cg_comp_function_t		v[3];
+} check_comp_t;
+
+typedef struct check_solid_t {
+	const char *				name;
+	cg_comp_solid_function_t	ref;
+	cg_comp_solid_function_t	v[3];
+} check_solid_t;
+
+static const char * check_width[3] = { "map", "v4", "v8" };
+
+static uint32_t check_seed = 0x12345678;
+
+static uint32_t
+check_rand(void)
+{
+	/* xorshift32, so the runs are the same everywhere */
+	check_seed ^= check_seed << 13;
+	check_seed ^= check_seed >> 17;
+	check_seed ^= check_seed << 5;
+	return check_seed;
+}
+
+/* mostly premultiplied pixels, with the opaque/transparent special cases */
+static uint32_t
+check_pixel(void)
+{
+	uint32_t r = check_rand();
+	switch(r & 7)
+	{
+		case 0:
+			return 0;
+		case 1:
+			return 0xff000000 | (r >> 8);
+		case 2:
+			return check_rand();
+		default:
+		{
+			uint32_t a = r >> 24;
+			uint32_t c = check_rand();
+			return (a << 24) |
+				(((c >> 16) & 0xff) * a / 255) << 16 |
+				(((c >> 8) & 0xff) * a / 255) << 8 |
+				((c & 0xff) * a / 255);
+		}
+	}
+}
+
+static uint32_t
+check_coverage(
+		int round)
+{
+	switch(round % 4)
+	{
+		case 0:
+			return 0;
+		case 1:
+			return 255;
+		default:
+			return check_rand() & 0xff;
+	}
+}
+
+static int
+check_report(
+		const char *name,
+		const char *width,
+		int len,
+		int off,
+		uint32_t coverage,
+		const uint32_t *want,
+		const uint32_t *got,
+		int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		if(want[i] == got[i])
+			continue;
+		fprintf(stderr,
+				"FAIL %s (%s) len %d offset %d coverage %u: "
+				"pixel %d is %08x, want %08x\n",
+				name, width, len, off, coverage,
+				i - off, got[i], want[i]);
+		return 1;
+	}
+	return 0;
+}
+
+int
+main()
+{
+	check_comp_t comp[] = {
+		{ .name = "source", .ref = __cg_comp_source },
+		{ .name = "source_over", .ref = __cg_comp_source_over },
+		{ .name = "destination_in", .ref = __cg_comp_destination_in },
+		{ .name = "destination_out", .ref = __cg_comp_destination_out },
+	};
+	check_solid_t solid[] = {
+		{ .name = "solid_source", .ref = __cg_comp_solid_source },
+		{ .name = "solid_source_over", .ref = __cg_comp_solid_source_over },
+		{ .name = "solid_destination_in", .ref = __cg_comp_solid_destination_in },
+		{ .name = "solid_destination_out", .ref = __cg_comp_solid_destination_out },
+	};
+	for(int op = 0; op < 4; op++)
+	{
+		comp[op].v[0] = cg_comp_map[op];
+		solid[op].v[0] = cg_comp_solid_map[op];
+	}
+#if CG_COMP_V4
+	comp[0].v[1] = cg_comp_source_v4;
+	comp[1].v[1] = cg_comp_source_over_v4;
+	comp[2].v[1] = cg_comp_destination_in_v4;
+	comp[3].v[1] = cg_comp_destination_out_v4;
+	solid[0].v[1] = cg_comp_solid_source_v4;
+	solid[1].v[1] = cg_comp_solid_source_over_v4;
+	solid[2].v[1] = cg_comp_solid_destination_in_v4;
+	solid[3].v[1] = cg_comp_solid_destination_out_v4;
+#endif
+#if CG_COMP_V8
+	if(__builtin_cpu_supports("avx2"))
+	{
+		comp[0].v[2] = cg_comp_source_v8;
+		comp[1].v[2] = cg_comp_source_over_v8;
+		comp[2].v[2] = cg_comp_destination_in_v8;
+		comp[3].v[2] = cg_comp_destination_out_v8;
+		solid[0].v[2] = cg_comp_solid_source_v8;
+		solid[1].v[2] = cg_comp_solid_source_over_v8;
+		solid[2].v[2] = cg_comp_solid_destination_in_v8;
+		solid[3].v[2] = cg_comp_solid_destination_out_v8;
+	}
+#endif
+	/* the span starts 1-4 pixels in, the rest catches writes past it */
+	uint32_t src[CHECK_MAX_LEN + 8];
+	uint32_t dst[CHECK_MAX_LEN + 8];
+	uint32_t want[CHECK_MAX_LEN + 8];
+	uint32_t got[CHECK_MAX_LEN + 8];
+	int failed = 0, checked = 0;
+
+	for(int round = 0; round < CHECK_ROUNDS; round++)
+	{
+		for(int len = 0; len <= CHECK_MAX_LEN && !failed; len++)
+		{
+			int off = 1 + (check_rand() & 3);
+			uint32_t coverage = check_coverage(round);
+			uint32_t color = check_pixel();
+			for(int i = 0; i < CHECK_MAX_LEN + 8; i++)
+			{
+				src[i] = check_pixel();
+				dst[i] = check_pixel();
+			}
+			for(int op = 0; op < 4; op++)
+			{
+				memcpy(want, dst, sizeof(dst));
+				comp[op].ref(want + off, len, src + off, coverage);
+				for(int w = 0; w < 3; w++)
+				{
+					if(!comp[op].v[w])
+						continue;
+					memcpy(got, dst, sizeof(dst));
+					comp[op].v[w](got + off, len, src + off, coverage);
+					failed |= check_report(comp[op].name, check_width[w],
+								len, off, coverage,
+								want, got, CHECK_MAX_LEN + 8);
+					checked++;
+				}
+				memcpy(want, dst, sizeof(dst));
+				solid[op].ref(want + off, len, color, coverage);
+				for(int w = 0; w < 3; w++)
+				{
+					if(!solid[op].v[w])
+						continue;
+					memcpy(got, dst, sizeof(dst));
+					solid[op].v[w](got + off, len, color, coverage);
+					failed |= check_report(solid[op].name, check_width[w],
+								len, off, coverage,
+								want, got, CHECK_MAX_LEN + 8);
+					checked++;
+				}
+			}
+		}
+	}
+	printf("cg_comp_check: %d spans checked, %s\n",
+			checked, failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * cg_dlist_check.c
+ *
+ * Copyright (C) 2024 Michel Pollet <buserror@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Round trip check for the display lists: a scene is recorded once, then
+ * replayed under several base matrices, and every replay has to be pixel
+ * identical to drawing the same scene directly through that matrix.
+ * The scene uses fills, strokes, dashes, gradients, path clips, and the
+ * device space scissor and clip boxes, which the replay has to map.
+ * Then every command of the list is damaged in turn, and the replay has to
+ * stop at it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "cg.h"
+
+#define CHECK_W		160
+#define CHECK_H		120
+
+/*
+ * Same rule as the replay: device space boxes only stay boxes when 'm'
+ * keeps them pixel aligned, otherwise they are clipped as a path.
+ */
+static int
+check_map_box(
+		const struct cg_matrix_t *m,
+		double b[4])
+{
+	if(m->b != 0.0 || m->c != 0.0 || m->a <= 0.0 || m->d <= 0.0)
+		return 0;
+	b[0] = b[0] * m->a + m->tx;
+	b[1] = b[1] * m->d + m->ty;
+	b[2] = b[2] * m->a + m->tx;
+	b[3] = b[3] * m->d + m->ty;
+	for(int i = 0; i < 4; i++)
+		if(b[i] != floor(b[i]))
+			return 0;
+	return 1;
+}
+
+/* cg_scissor() as it would be recorded, with 'm' applied by hand */
+static void
+check_scissor(
+		struct cg_ctx_t *ctx,
+		const struct cg_matrix_t *m,
+		double x, double y, double w, double h)
+{
+	double b[4] = { x, y, x + w, y + h };
+	if(check_map_box(m, b))
+		cg_scissor(ctx, b[0], b[1], b[2] - b[0], b[3] - b[1]);
+	else
+	{
+		cg_rectangle(ctx, x, y, w, h);
+		cg_clip(ctx);
+	}
+}
+
+/* cg_clip_boxes() as it would be recorded, with 'm' applied by hand */
+static void
+check_clip_boxes(
+		struct cg_ctx_t *ctx,
+		const struct cg_matrix_t *m,
+		const struct cg_box_t *boxes,
+		int count)
+{
+	struct cg_box_t mapped[count];
+	for(int i = 0; i < count; i++)
+	{
+		double b[4] = { boxes[i].x1, boxes[i].y1, boxes[i].x2, boxes[i].y2 };
+		if(!check_map_box(m, b))
+		{
+			for(int j = 0; j < count; j++)
+				cg_rectangle(ctx, boxes[j].x1, boxes[j].y1,
+						boxes[j].x2 - boxes[j].x1, boxes[j].y2 - boxes[j].y1);
+			cg_clip(ctx);
+			return;
+		}
+		mapped[i] = (struct cg_box_t){ b[0], b[1], b[2], b[3] };
+	}
+	cg_clip_boxes(ctx, mapped, count);
+}
+
+/*
+ * Draws the scene through 'm'. When recording, 'm' is the identity, and
+ * the replay brings in the real matrix.
+ */
+static void
+check_scene(
+		struct cg_ctx_t *ctx,
+		const struct cg_matrix_t *m)
+{
+	static const struct cg_box_t boxes[] = {
+		{ 10, 60, 40, 80 }, { 50, 60, 70, 80 }, { 20, 80, 60, 100 },
+	};
+	cg_save(ctx);
+	cg_set_matrix(ctx, (struct cg_matrix_t *)m);
+
+	cg_set_source_rgb(ctx, 0.9, 0.9, 0.85);
+	cg_rectangle(ctx, 0, 0, 120, 110);
+	cg_fill(ctx);
+
+	cg_set_source_rgba(ctx, 0.2, 0.4, 0.8, 0.7);
+	cg_round_rectangle(ctx, 8.5, 6.25, 50, 30, 6, 6);
+	cg_fill_preserve(ctx);
+	cg_set_source_rgb(ctx, 0, 0, 0);
+	cg_set_line_width(ctx, 1.5);
+	cg_stroke(ctx);
+
+	cg_save(ctx);
+	double dashes[] = { 4, 2.5 };
+	cg_set_dash(ctx, dashes, 2, 1);
+	cg_set_line_width(ctx, 2);
+	cg_set_source_rgb(ctx, 0.8, 0.1, 0.1);
+	cg_circle(ctx, 90, 25, 18);
+	cg_stroke(ctx);
+	cg_restore(ctx);
+
+	/* the scissor, then a gradient fill larger than it */
+	cg_save(ctx);
+	check_scissor(ctx, m, 64, 40, 50, 30);
+	struct cg_gradient_t *g = cg_set_source_linear_gradient(ctx, 60, 0, 115, 0);
+	cg_gradient_add_stop_rgb(g, 0, 1, 1, 0);
+	cg_gradient_add_stop_rgb(g, 1, 0, 0.5, 0);
+	cg_rectangle(ctx, 58, 35, 60, 40);
+	cg_fill(ctx);
+	cg_restore(ctx);
+
+	/* clip boxes, painted through */
+	cg_save(ctx);
+	check_clip_boxes(ctx, m, boxes, 3);
+	cg_set_source_rgba(ctx, 0.1, 0.6, 0.2, 0.6);
+	cg_paint(ctx);
+	cg_restore(ctx);
+
+	/* a path clip in user space, and a nested scissor in it */
+	cg_save(ctx);
+	cg_ellipse(ctx, 95, 90, 22, 14);
+	cg_clip(ctx);
+	cg_set_source_rgb(ctx, 0.5, 0.2, 0.6);
+	cg_paint(ctx);
+	cg_save(ctx);
+	check_scissor(ctx, m, 90, 76, 30, 10);
+	cg_set_source_rgb(ctx, 1, 0.6, 0);
+	cg_paint(ctx);
+	cg_restore(ctx);
+	cg_restore(ctx);
+
+	cg_restore(ctx);
+}
+
+static void
+check_clear(
+		struct cg_surface_t *s)
+{
+	memset(s->pixels, 0, (size_t)s->stride * s->height);
+}
+
+static int
+check_compare(
+		const char *name,
+		struct cg_surface_t *want,
+		struct cg_surface_t *got)
+{
+	for(int y = 0; y < want->height; y++)
+	{
+		uint32_t *w = (uint32_t *)((char *)want->pixels + y * want->stride);
+		uint32_t *g = (uint32_t *)((char *)got->pixels + y * got->stride);
+		for(int x = 0; x < want->width; x++)
+		{
+			if(w[x] == g[x])
+				continue;
+			fprintf(stderr, "FAIL %s: pixel %d,%d is %08x, want %08x\n",
+					name, x, y, g[x], w[x]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+check_replay(
+		struct cg_ctx_t *ctx,
+		struct cg_dlist_t *dl,
+		unsigned char *data,
+		int size)
+{
+	/* replay only reads the commands, so a copy can point at other ones */
+	struct cg_dlist_t copy = *dl;
+	copy.cmds.data = data;
+	copy.cmds.size = size;
+	check_clear(ctx->surface);
+	cg_dlist_replay(ctx, &copy);
+}
+
+/*
+ * Damaged lists: a command whose size runs past the end, or doesn't hold
+ * what its op reads, stops the replay there, so it draws the same as the
+ * list cut just before that command.
+ */
+static int
+check_damaged(
+		struct cg_ctx_t *want_ctx,
+		struct cg_ctx_t *got_ctx,
+		struct cg_dlist_t *dl)
+{
+	unsigned char *data = malloc(dl->cmds.size);
+	int failed = 0, checked = 0;
+
+	for(int off = 0; off + 8 <= dl->cmds.size && !failed; )
+	{
+		uint32_t h[2];
+		memcpy(h, dl->cmds.data + off, sizeof(h));
+		check_replay(want_ctx, dl, dl->cmds.data, off);
+		for(int k = 0; k < 2 && !failed; k++)
+		{
+			uint32_t size;
+			if(k == 0)
+				size = 0x7ffffff8;	/* past the end */
+			else if(h[0] != CG_DL_HEADER && h[1] >= 8)
+				size = h[1] - 8;	/* a count too many */
+			else
+				continue;
+			char name[64];
+			memcpy(data, dl->cmds.data, dl->cmds.size);
+			memcpy(data + off + 4, &size, sizeof(size));
+			check_replay(got_ctx, dl, data, dl->cmds.size);
+			snprintf(name, sizeof(name), "damaged op %u at %d", h[0], off);
+			failed |= check_compare(name, want_ctx->surface, got_ctx->surface);
+			checked++;
+		}
+		off += 8 + h[1];
+	}
+	free(data);
+	printf("cg_dlist_check: %d damaged lists checked, %s\n",
+			checked, failed ? "FAILED" : "ok");
+	return failed;
+}
+
+int
+main()
+{
+	static const struct {
+		const char *	name;
+		double 			tx, ty, scale, angle;
+	} base[] = {
+		{ "identity", 0, 0, 1, 0 },
+		{ "translate", 13, -7, 1, 0 },
+		{ "scale", 5, 3, 1.5, 0 },
+		{ "fraction", 3.5, 2.25, 1, 0 },
+		{ "rotate", 40, -10, 1, 0.3 },
+	};
+	struct cg_surface_t *want = cg_surface_create(CHECK_W, CHECK_H);
+	struct cg_surface_t *got = cg_surface_create(CHECK_W, CHECK_H);
+	struct cg_ctx_t *direct = cg_create(want);
+	struct cg_ctx_t *replay = cg_create(got);
+	struct cg_dlist_t *dl = cg_dlist_create();
+	struct cg_matrix_t identity;
+	int failed = 0;
+
+	cg_matrix_init_identity(&identity);
+	cg_dlist_begin(replay, dl);
+	check_scene(replay, &identity);
+	cg_dlist_end(replay);
+
+	for(unsigned i = 0; i < sizeof(base) / sizeof(base[0]); i++)
+	{
+		struct cg_matrix_t m;
+		cg_matrix_init_translate(&m, base[i].tx, base[i].ty);
+		cg_matrix_scale(&m, base[i].scale, base[i].scale);
+		cg_matrix_rotate(&m, base[i].angle);
+
+		check_clear(want);
+		check_scene(direct, &m);
+
+		check_clear(got);
+		cg_save(replay);
+		cg_set_matrix(replay, &m);
+		cg_dlist_replay(replay, dl);
+		cg_restore(replay);
+
+		failed |= check_compare(base[i].name, want, got);
+	}
+	printf("cg_dlist_check: %d replays checked, %s\n",
+			(int)(sizeof(base) / sizeof(base[0])), failed ? "FAILED" : "ok");
+	cg_set_matrix(direct, &identity);
+	cg_set_matrix(replay, &identity);
+	failed |= check_damaged(direct, replay, dl);
+	cg_dlist_destroy(dl);
+	cg_destroy(direct);
+	cg_destroy(replay);
+	cg_surface_destroy(want);
+	cg_surface_destroy(got);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * cg_flatten_bench.c
+ *
+ * Copyright (C) 2024 Michel Pollet <buserror@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Benchmarks the flattening of dashed curves. flatten() used to take a
+ * fixed 0.25 tolerance in user space ("before"); it's now CG_FLATTEN_TOLERANCE
+ * device pixels, divided by the matrix scale ("after"). For circles and
+ * round rectangles of a few radii, drawn at several scales, this reports
+ * the segment counts and the time per shape of both, and the time of the
+ * whole dashed stroke as it is now. At scale 1 both are the same.
+ *
+ * cg.c is included so the dasher can be driven directly.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cg.c"
+
+#define BENCH_SIZE		512
+#define BENCH_ROUNDS	1000
+
+static const char * shape_name[] = { "circle", "rrect" };
+
+/* counts the lines a path flattens to, through a dasher that never dashes */
+static void
+bench_count_move(
+		struct cg_dasher_t *d,
+		double x,
+		double y)
+{
+}
+
+static void
+bench_count_line(
+		struct cg_dasher_t *d,
+		double x,
+		double y)
+{
+	(*(int *)d->user)++;
+}
+
+static int
+bench_flatten(
+		struct cg_path_t *path,
+		double tolerance)
+{
+	double on = 1e30;
+	struct cg_dash_t dash = { .offset = 0, .data = &on, .size = 1 };
+	int count = 0;
+	struct cg_dasher_t d = {
+		.move_to = bench_count_move,
+		.line_to = bench_count_line,
+		.user = &count,
+	};
+	cg_dasher_init(&d, &dash);
+	cg_dasher_path(&d, path, tolerance);
+	return count;
+}
+
+static double
+bench_now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static void
+bench_path(
+		struct cg_ctx_t *ctx,
+		int shape,
+		double r)
+{
+	cg_new_path(ctx);
+	if(shape == 0)
+		cg_circle(ctx, 10 + r, 10 + r, r);
+	else
+		cg_round_rectangle(ctx, 10, 10, 4 * r + 10, 3 * r + 6, r, r);
+}
+
+/* best of a few runs, in microseconds per shape */
+static double
+bench_time_flatten(
+		struct cg_path_t *path,
+		double tolerance)
+{
+	double best = 1e30;
+	for(int k = 0; k < 5; k++)
+	{
+		double t = bench_now();
+		for(int i = 0; i < BENCH_ROUNDS; i++)
+			bench_flatten(path, tolerance);
+		t = (bench_now() - t) / BENCH_ROUNDS;
+		if(t < best)
+			best = t;
+	}
+	return best;
+}
+
+static double
+bench_time_stroke(
+		struct cg_ctx_t *ctx,
+		int shape,
+		double r)
+{
+	double best = 1e30;
+	for(int k = 0; k < 5; k++)
+	{
+		double t = bench_now();
+		for(int i = 0; i < BENCH_ROUNDS; i++)
+		{
+			bench_path(ctx, shape, r);
+			cg_stroke(ctx);
+		}
+		t = (bench_now() - t) / BENCH_ROUNDS;
+		if(t < best)
+			best = t;
+	}
+	return best;
+}
+
+int
+main()
+{
+	static const double radius[] = { 4, 8, 24, 64 };
+	static const double scale[] = { 0.25, 0.5, 1, 2, 4 };
+	double dashes[] = { 3, 2 };
+	struct cg_surface_t *s = cg_surface_create(BENCH_SIZE, BENCH_SIZE);
+	struct cg_ctx_t *ctx = cg_create(s);
+
+	cg_set_source_rgb(ctx, 0, 0, 0);
+	cg_set_dash(ctx, dashes, 2, 0);
+	printf("%-6s %6s %5s | %6s | %6s %6s | %8s %8s | %8s\n",
+			"shape", "radius", "scale", "cubics", "before", "after",
+			"before", "after", "stroke");
+	for(int shape = 0; shape < 2; shape++)
+	{
+		for(unsigned i = 0; i < sizeof(radius) / sizeof(radius[0]); i++)
+		{
+			for(unsigned j = 0; j < sizeof(scale) / sizeof(scale[0]); j++)
+			{
+				double r = radius[i];
+				cg_identity_matrix(ctx);
+				cg_scale(ctx, scale[j], scale[j]);
+				cg_set_line_width(ctx, 1.0 / scale[j]);
+				bench_path(ctx, shape, r);
+
+				struct cg_path_t *path = ctx->path;
+				double after = CG_FLATTEN_TOLERANCE /
+							cg_matrix_get_scale(&ctx->state->matrix);
+				int cubics = 0;
+				for(int e = 0; e < path->elements.size; e++)
+					cubics += path->elements.data[e] ==
+									CG_PATH_ELEMENT_CURVE_TO;
+				int lines_before = bench_flatten(path, CG_FLATTEN_TOLERANCE);
+				int lines_after = bench_flatten(path, after);
+				double time_before = bench_time_flatten(path, CG_FLATTEN_TOLERANCE);
+				double time_after = bench_time_flatten(path, after);
+				/* this one uses up the path */
+				double time_stroke = bench_time_stroke(ctx, shape, r);
+				printf("%-6s %6.0f %5.2f | %6d | %6d %6d | "
+						"%6.2fus %6.2fus | %6.2fus\n",
+						shape_name[shape], r, scale[j], cubics,
+						lines_before, lines_after,
+						time_before, time_after, time_stroke);
+			}
+		}
+	}
+	cg_destroy(ctx);
+	cg_surface_destroy(s);
+	return 0;
+}
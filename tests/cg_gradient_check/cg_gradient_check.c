@@ -0,0 +1,338 @@
+/*
+ * cg_gradient_check.c
+ *
+ * Copyright (C) 2024 Michel Pollet <buserror@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Checks the linear gradient fast paths and the gradient color table cache.
+ * cg.c is included here so the static functions are visible.
+ *
+ * blend_linear_gradient() has a vertical (one color per span) and a
+ * horizontal (one fetch per column run) shortcut; both are compared, pixel
+ * for pixel, to the plain fetch-and-blend loop, for every operator, all the
+ * spread methods, random coverage and spans longer than the 1024 pixel fetch
+ * buffer. Then the cached color tables are compared to freshly built ones,
+ * with more stop sets and opacities than the cache holds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cg.c"
+
+#define CHECK_WIDTH		2600
+#define CHECK_HEIGHT	24
+#define CHECK_ROUNDS	20
+#define CHECK_LUTS		(CG_GRADIENT_LUT_CACHE * 2 + 1)
+
+static const char * check_op[] = {
+	"source", "source_over", "destination_in", "destination_out" };
+static const char * check_spread[] = { "pad", "reflect", "repeat" };
+
+typedef struct check_case_t {
+	const char *		name;
+	double				x1, y1, x2, y2;
+	struct cg_matrix_t	m;		/* device to gradient space */
+} check_case_t;
+
+static uint32_t check_seed = 0x12345678;
+
+static uint32_t
+check_rand(void)
+{
+	/* xorshift32, so the runs are the same everywhere */
+	check_seed ^= check_seed << 13;
+	check_seed ^= check_seed >> 17;
+	check_seed ^= check_seed << 5;
+	return check_seed;
+}
+
+static uint32_t
+check_pixel(void)
+{
+	uint32_t r = check_rand();
+	uint32_t a = r >> 24;
+	uint32_t c = check_rand();
+	if(r & 1)
+		return 0xff000000 | (c >> 8);
+	return (a << 24) |
+		(((c >> 16) & 0xff) * a / 255) << 16 |
+		(((c >> 8) & 0xff) * a / 255) << 8 |
+		((c & 0xff) * a / 255);
+}
+
+static uint32_t
+check_coverage(void)
+{
+	uint32_t r = check_rand();
+	switch(r & 3)
+	{
+		case 0:
+		case 1:
+			return 255;
+		default:
+			return (r >> 8) & 0xff;
+	}
+}
+
+/* random stops, sorted, some of them translucent */
+static void
+check_stops(
+		struct cg_gradient_t *g)
+{
+	int count = 2 + check_rand() % 4;
+	double offset = 0;
+	cg_gradient_clear_stops(g);
+	for(int i = 0; i < count; i++)
+	{
+		cg_gradient_add_stop_rgba(g, offset,
+				(check_rand() & 0xff) / 255.0,
+				(check_rand() & 0xff) / 255.0,
+				(check_rand() & 0xff) / 255.0,
+				(check_rand() & 1) ? 1.0 : (check_rand() & 0xff) / 255.0);
+		offset += (1.0 - offset) * (check_rand() % 100) / 100.0;
+	}
+}
+
+/*
+ * A few rows of spans; the row pairs repeat the same x and length, which
+ * is what the horizontal path caches on, the others are all over the place.
+ */
+static void
+check_spans(
+		struct cg_rle_t *rle)
+{
+	static const int lengths[] = { 1, 8, 9, 1023, 1024, 1025, 2048, 2599 };
+	rle->spans.size = 0;
+	for(int y = 0; y < CHECK_HEIGHT; y++)
+	{
+		if(y & 1)
+		{
+			/* same spans as the row above */
+			int n = rle->spans.size;
+			for(int i = 0; i < n; i++)
+			{
+				if(rle->spans.data[i].y != y - 1)
+					continue;
+				cg_array_ensure(rle->spans, 1);
+				struct cg_span_t *s = &rle->spans.data[rle->spans.size++];
+				*s = rle->spans.data[i];
+				s->y = y;
+				s->coverage = check_coverage();
+			}
+			continue;
+		}
+		int x = check_rand() % 40;
+		while(x < CHECK_WIDTH)
+		{
+			int len;
+			if(check_rand() & 1)
+				len = lengths[check_rand() % 8];
+			else
+				len = 1 + check_rand() % 300;
+			if(x + len > CHECK_WIDTH)
+				len = CHECK_WIDTH - x;
+			cg_array_ensure(rle->spans, 1);
+			struct cg_span_t *s = &rle->spans.data[rle->spans.size++];
+			s->x = x;
+			s->y = y;
+			s->len = len;
+			s->coverage = check_coverage();
+			x += len + check_rand() % 40;
+		}
+	}
+}
+
+/* the general path of blend_linear_gradient(), without the shortcuts */
+static void
+check_reference(
+		struct cg_surface_t *surface,
+		enum cg_operator_t op,
+		struct cg_rle_t *rle,
+		struct cg_gradient_data_t *gradient)
+{
+	cg_comp_function_t func = cg_comp_map[op];
+	uint32_t buffer[1024];
+	struct cg_linear_gradient_values_t v;
+
+	v.dx = gradient->linear.x2 - gradient->linear.x1;
+	v.dy = gradient->linear.y2 - gradient->linear.y1;
+	v.l = v.dx * v.dx + v.dy * v.dy;
+	v.off = 0.0;
+	if(v.l != 0.0)
+	{
+		v.dx /= v.l;
+		v.dy /= v.l;
+		v.off = -v.dx * gradient->linear.x1 - v.dy * gradient->linear.y1;
+	}
+	for(int i = 0; i < rle->spans.size; i++)
+	{
+		struct cg_span_t *s = &rle->spans.data[i];
+		int x = s->x, length = s->len;
+		while(length)
+		{
+			int l = CG_MIN(length, 1024);
+			fetch_linear_gradient(buffer, &v, gradient, s->y, x, l);
+			uint32_t *target = (uint32_t *)(surface->pixels +
+									s->y * surface->stride) + x;
+			func(target, l, buffer, s->coverage);
+			x += l;
+			length -= l;
+		}
+	}
+}
+
+static int
+check_report(
+		const char *name,
+		const char *what,
+		struct cg_surface_t *want,
+		struct cg_surface_t *got)
+{
+	for(int y = 0; y < CHECK_HEIGHT; y++)
+	{
+		uint32_t *w = (uint32_t *)(want->pixels + y * want->stride);
+		uint32_t *g = (uint32_t *)(got->pixels + y * got->stride);
+		for(int x = 0; x < CHECK_WIDTH; x++)
+		{
+			if(w[x] == g[x])
+				continue;
+			fprintf(stderr, "FAIL %s %s: pixel %d,%d is %08x, want %08x\n",
+					name, what, x, y, g[x], w[x]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+check_blend(
+		struct cg_ctx_t *ctx,
+		struct cg_gradient_t *g,
+		struct cg_rle_t *rle,
+		struct cg_surface_t *base,
+		struct cg_surface_t *want,
+		struct cg_surface_t *got,
+		int *checked)
+{
+	static const check_case_t cases[] = {
+		{ "vertical", 0, 0, 0, 20, { 1, 0, 0, 1, 0, 0 } },
+		{ "vertical scaled", 0, 5, 0, 12, { 0.5, 0, 0, 0.75, 3, -2 } },
+		{ "vertical swapped", 0, 0, 30, 0, { 0, 1, 1, 0, 0, 0 } },
+		/*
+		 * nearly vertical: inc is under 1e-5, but it still moves some
+		 * rows across a color table entry over a long span
+		 */
+		{ "vertical tilted", 0, 0, 0, 20, { 1, 1.9e-7, 0, 1, 0, 1.46473 } },
+		{ "horizontal", 10, 0, 700, 0, { 1, 0, 0, 1, 0, 0 } },
+		{ "horizontal scaled", -40, 3, 90, 3, { 0.125, 0, 0, 2, 7.5, 0 } },
+		{ "horizontal swapped", 0, 0, 0, 400, { 0, 1, 1, 0, 0, 0 } },
+		{ "diagonal", 0, 0, 900, 30, { 1, 0.2, -0.1, 1, 0, 0 } },
+	};
+	int failed = 0;
+
+	for(unsigned c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+	{
+		for(int spread = 0; spread < 3; spread++)
+		{
+			struct cg_gradient_data_t data = {
+				.spread = spread,
+				.matrix = cases[c].m,
+				.colortable = cg_gradient_get_lut(ctx, g, 1.0),
+				.linear = {
+					cases[c].x1, cases[c].y1, cases[c].x2, cases[c].y2 },
+			};
+			for(int op = 0; op < 4 && !failed; op++)
+			{
+				char what[64];
+				memcpy(want->pixels, base->pixels, base->stride * base->height);
+				memcpy(got->pixels, base->pixels, base->stride * base->height);
+				check_reference(want, op, rle, &data);
+				blend_linear_gradient(got, op, rle, &data);
+				snprintf(what, sizeof(what), "%s %s",
+						check_spread[spread], check_op[op]);
+				failed |= check_report(cases[c].name, what, want, got);
+				(*checked)++;
+			}
+		}
+	}
+	return failed;
+}
+
+/* the cached tables against new ones, for more stop sets than it holds */
+static int
+check_luts(
+		struct cg_ctx_t *ctx,
+		int *checked)
+{
+	static const double opacity[] = { 1.0, 0.5, 0.25 };
+	struct cg_gradient_t g[CHECK_LUTS] = {};
+	uint32_t want[1024];
+	int failed = 0;
+
+	for(int i = 0; i < CHECK_LUTS; i++)
+	{
+		cg_gradient_init_linear(&g[i], 0, 0, 1, 0);
+		check_stops(&g[i]);
+	}
+	for(int round = 0; round < CHECK_LUTS * 20 && !failed; round++)
+	{
+		/* runs of the same one, so it also hits */
+		int i = (round / 3 + (check_rand() & 1)) % CHECK_LUTS;
+		double o = opacity[check_rand() % 3];
+		uint32_t *got = cg_gradient_get_lut(ctx, &g[i], o);
+		cg_gradient_build_lut(want, &g[i], o);
+		if(memcmp(want, got, sizeof(want)))
+		{
+			fprintf(stderr, "FAIL lut %d opacity %.2f: stale table\n", i, o);
+			failed = 1;
+		}
+		if(cg_gradient_get_lut(ctx, &g[i], o) != got)
+		{
+			fprintf(stderr, "FAIL lut %d opacity %.2f: not cached\n", i, o);
+			failed = 1;
+		}
+		(*checked)++;
+	}
+	for(int i = 0; i < CHECK_LUTS; i++)
+		cg_gradient_destroy(&g[i]);
+	return failed;
+}
+
+int
+main()
+{
+	struct cg_surface_t *base = cg_surface_create(CHECK_WIDTH, CHECK_HEIGHT);
+	struct cg_surface_t *want = cg_surface_create(CHECK_WIDTH, CHECK_HEIGHT);
+	struct cg_surface_t *got = cg_surface_create(CHECK_WIDTH, CHECK_HEIGHT);
+	struct cg_ctx_t *ctx = cg_create(want);
+	struct cg_gradient_t g = {};
+	struct cg_rle_t *rle = cg_rle_create();
+	int failed = 0, checked = 0;
+
+	cg_gradient_init_linear(&g, 0, 0, 1, 0);
+	for(int round = 0; round < CHECK_ROUNDS && !failed; round++)
+	{
+		for(int y = 0; y < CHECK_HEIGHT; y++)
+		{
+			uint32_t *p = (uint32_t *)(base->pixels + y * base->stride);
+			for(int x = 0; x < CHECK_WIDTH; x++)
+				p[x] = check_pixel();
+		}
+		check_stops(&g);
+		check_spans(rle);
+		failed |= check_blend(ctx, &g, rle, base, want, got, &checked);
+	}
+	if(!failed)
+		failed |= check_luts(ctx, &checked);
+	cg_gradient_destroy(&g);
+	cg_rle_destroy(rle);
+	cg_destroy(ctx);
+	cg_surface_destroy(base);
+	cg_surface_destroy(want);
+	cg_surface_destroy(got);
+	printf("cg_gradient_check: %d blends and tables checked, %s\n",
+			checked, failed ? "FAILED" : "ok");
+	return failed;
+}
@@ -0,0 +1,215 @@
+/*
+ * cg_translate_check.c
+ *
+ * Copyright (C) 2024 Michel Pollet <buserror@gmail.com>
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Checks that the translate only shortcut of ft_outline_convert() (and of
+ * the dash stroker) gives exactly what cg_matrix_map_point() gives.
+ * cg.c is included here so the static functions are visible.
+ *
+ * Random points are offset both ways and compared bit for bit, then random
+ * paths are converted by ft_outline_convert() and by a copy of it that
+ * always maps the points with the matrix, and the outlines are compared.
+ * The offsets are integer and fractional, small and large.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cg.c"
+
+#define CHECK_POINTS	100000
+#define CHECK_PATHS		200
+
+static const double check_offset[][2] = {
+	{ 0, 0 }, { 1, 0 }, { 0, -1 }, { -7, 13 }, { 1000, -2000 },
+	{ -100000, 65536 },
+	{ 0.5, 0.5 }, { -0.25, 0.75 }, { 0.1, -0.3 }, { 1.0 / 3, 2.0 / 3 },
+	{ 123.456, -7.89 }, { -1e-9, 1e-9 }, { 1e6 + 0.3, -1e6 - 0.7 },
+};
+#define CHECK_OFFSETS	(int)(sizeof(check_offset) / sizeof(check_offset[0]))
+
+static uint32_t check_seed = 0x12345678;
+
+static uint32_t
+check_rand(void)
+{
+	/* xorshift32, so the runs are the same everywhere */
+	check_seed ^= check_seed << 13;
+	check_seed ^= check_seed >> 17;
+	check_seed ^= check_seed << 5;
+	return check_seed;
+}
+
+/* a coordinate, pixel aligned, on a fraction of one, or anything */
+static double
+check_coord(void)
+{
+	uint32_t r = check_rand();
+	double v = (double)(check_rand() % 2000) - 1000;
+	switch(r & 3)
+	{
+		case 0:
+			return v;
+		case 1:
+			return v + (double)((r >> 8) & 63) / 64;
+		case 2:
+			return v * 1000.0 / ((r >> 8) | 1);
+		default:
+			return (r & 4) ? -0.0 : 0.0;
+	}
+}
+
+static void
+check_path(
+		struct cg_path_t *path)
+{
+	cg_path_clear(path);
+	int count = 1 + check_rand() % 20;
+	for(int i = 0; i < count; i++)
+	{
+		switch(check_rand() % 5)
+		{
+			case 0:
+				cg_path_move_to(path, check_coord(), check_coord());
+				break;
+			case 1:
+			case 2:
+				cg_path_line_to(path, check_coord(), check_coord());
+				break;
+			case 3:
+				cg_path_curve_to(path, check_coord(), check_coord(),
+						check_coord(), check_coord(),
+						check_coord(), check_coord());
+				break;
+			default:
+				cg_path_close(path);
+				break;
+		}
+	}
+}
+
+/* ft_outline_convert(), with every point going through the matrix */
+static void
+check_convert(
+		XCG_FT_Outline *outline,
+		struct cg_ctx_t *ctx,
+		struct cg_path_t *path,
+		struct cg_matrix_t *matrix)
+{
+	ft_outline_init(outline, ctx, path->points.size, path->contours);
+	enum cg_path_element_t *elements = path->elements.data;
+	struct cg_point_t *points = path->points.data;
+	struct cg_point_t p[3];
+	for(int i = 0; i < path->elements.size; i++)
+	{
+		switch(elements[i])
+		{
+			case CG_PATH_ELEMENT_MOVE_TO:
+				cg_matrix_map_point(matrix, &points[0], &p[0]);
+				ft_outline_move_to(outline, p[0].x, p[0].y);
+				points += 1;
+				break;
+			case CG_PATH_ELEMENT_LINE_TO:
+				cg_matrix_map_point(matrix, &points[0], &p[0]);
+				ft_outline_line_to(outline, p[0].x, p[0].y);
+				points += 1;
+				break;
+			case CG_PATH_ELEMENT_CURVE_TO:
+				cg_matrix_map_point(matrix, &points[0], &p[0]);
+				cg_matrix_map_point(matrix, &points[1], &p[1]);
+				cg_matrix_map_point(matrix, &points[2], &p[2]);
+				ft_outline_curve_to(outline, p[0].x, p[0].y,
+						p[1].x, p[1].y, p[2].x, p[2].y);
+				points += 3;
+				break;
+			case CG_PATH_ELEMENT_CLOSE:
+				ft_outline_close(outline);
+				points += 1;
+				break;
+		}
+	}
+	ft_outline_end(outline);
+}
+
+static int
+check_outline(
+		int path,
+		const double *offset,
+		XCG_FT_Outline *want,
+		XCG_FT_Outline *got)
+{
+	int bad = (want->n_points != got->n_points) ||
+			(want->n_contours != got->n_contours);
+	if(!bad)
+		bad = memcmp(want->points, got->points,
+					want->n_points * sizeof(XCG_FT_Vector)) ||
+			memcmp(want->tags, got->tags, want->n_points) ||
+			memcmp(want->contours, got->contours,
+					want->n_contours * sizeof(int)) ||
+			memcmp(want->contours_flag, got->contours_flag,
+					want->n_contours);
+	if(bad)
+		fprintf(stderr, "FAIL path %d offset %g,%g: outlines differ\n",
+				path, offset[0], offset[1]);
+	return bad;
+}
+
+int
+main()
+{
+	struct cg_surface_t *s = cg_surface_create(16, 16);
+	struct cg_ctx_t *want_ctx = cg_create(s);
+	struct cg_ctx_t *got_ctx = cg_create(s);
+	struct cg_path_t *path = cg_path_create();
+	int failed = 0, checked = 0;
+
+	for(int o = 0; o < CHECK_OFFSETS && !failed; o++)
+	{
+		struct cg_matrix_t m;
+		cg_matrix_init_translate(&m, check_offset[o][0], check_offset[o][1]);
+		/* the points, as the shortcuts offset them */
+		struct cg_dash_stroker_t ds = { .matrix = &m, .translate = 1 };
+		struct cg_dash_stroker_t dm = { .matrix = &m, .translate = 0 };
+		for(int i = 0; i < CHECK_POINTS && !failed; i++)
+		{
+			struct cg_point_t p = { check_coord(), check_coord() };
+			struct cg_point_t want, got;
+			XCG_FT_Vector vs, vm;
+			cg_matrix_map_point(&m, &p, &want);
+			got.x = p.x + m.tx;
+			got.y = p.y + m.ty;
+			cg_dash_stroker_map(&ds, p.x, p.y, &vs);
+			cg_dash_stroker_map(&dm, p.x, p.y, &vm);
+			if(memcmp(&want, &got, sizeof(want)) ||
+					(vs.x != vm.x) || (vs.y != vm.y))
+			{
+				fprintf(stderr, "FAIL point %a,%a offset %g,%g: "
+						"%a,%a, want %a,%a\n", p.x, p.y,
+						check_offset[o][0], check_offset[o][1],
+						got.x, got.y, want.x, want.y);
+				failed = 1;
+			}
+			checked++;
+		}
+		/* and whole outlines */
+		for(int i = 0; i < CHECK_PATHS && !failed; i++)
+		{
+			XCG_FT_Outline want, got;
+			check_path(path);
+			check_convert(&want, want_ctx, path, &m);
+			ft_outline_convert(&got, got_ctx, path, &m);
+			failed |= check_outline(i, check_offset[o], &want, &got);
+			checked++;
+		}
+	}
+	cg_path_destroy(path);
+	cg_destroy(want_ctx);
+	cg_destroy(got_ctx);
+	cg_surface_destroy(s);
+	printf("cg_translate_check: %d points and outlines checked, %s\n",
+			checked, failed ? "FAILED" : "ok");
+	return failed;
+}